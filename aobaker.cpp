@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "aobaker.h"
+#include "mappedfile.h"
+#include "model.h"
+#include "shadowmap.h"
+#include "threadpool.h"
+
+//Cache layout: header followed by one float per vertex
+static const char AO_CACHE_MAGIC[8] = { 'Z', 'R', 'A', 'O', 0, 0, 0, 0 };
+static const unsigned int AO_CACHE_VERSION = 2;
+static const unsigned int AO_CACHE_ENDIAN = 0x01020304;
+static const int AO_VERTEX_BATCH = 4096;
+
+struct AOCacheHeader {
+    char magic[8];
+    unsigned int endian;
+    unsigned int version;
+    long long sourceSize;
+    long long sourceTime;
+    int nverts;
+    int directions;
+    int mapSize;
+};
+
+bool bakeAO(Model* model, ThreadPool& pool, std::vector<float>& ao, int directions, int mapSize) {
+    int n = model->nverts();
+    if (n == 0 || directions <= 0) return false;
+    //Vertex normals from the corners that reference each vertex
+    std::vector<Vec3f> normals(n, Vec3f(0, 0, 0));
+    for (int i = 0; i < model->nfaces(); i++) {
+        for (int j = 0; j < 3; j++) normals[model->vertIndex(i, j)] += model->normal(i, j);
+    }
+    for (Vec3f& normal : normals) {
+        if (normal.norm() > 0) normal.normalize();
+    }
+    Vec3f center = (model->getBBoxMin() + model->getBBoxMax()) * 0.5f;
+    float radius = std::max(1e-3f, (model->getBBoxMax() - model->getBBoxMin()).norm() * 0.5f * 1.05f);
+    //Pushes the lookup off the surface so a vertex does not occlude itself
+    float offset = radius * 2.0f / mapSize;
+    std::vector<float> visible(n, 0.0f), total(n, 0.0f);
+    Span<Vec3f> verts = model->verts();
+    for (int d = 0; d < directions; d++) {
+        //Fibonacci sphere, the sky direction s is where the light comes from
+        float y = 1.0f - 2.0f * (d + 0.5f) / directions;
+        float r = std::sqrt(std::max(0.0f, 1.0f - y * y));
+        float phi = d * 2.39996323f;
+        Vec3f s(r * std::cos(phi), y, r * std::sin(phi));
+        //getView needs an up vector that is not parallel to the view direction
+        if (std::abs(s.y()) > 0.999f) s = Vec3f(0.01f, s.y(), 0.0f).normalized();
+        ShadowMap map(mapSize, -s, center, radius);
+        map.setPCF(true);
+        map.render(model, pool);
+        pool.parallelFor((n + AO_VERTEX_BATCH - 1) / AO_VERTEX_BATCH, [&](int batch, int worker) {
+            int end = std::min(n, (batch + 1) * AO_VERTEX_BATCH);
+            for (int i = batch * AO_VERTEX_BATCH; i < end; i++) {
+                float cosine = normals[i].dot(s);
+                if (cosine <= 0) continue;
+                visible[i] += cosine * map.lit(map.transform(verts[i] + normals[i] * offset));
+                total[i] += cosine;
+            }
+        });
+    }
+    ao.resize(n);
+    for (int i = 0; i < n; i++) ao[i] = total[i] > 0 ? visible[i] / total[i] : 1.0f;
+    return true;
+}
+
+static bool readAOCache(const std::string& cachefile, long long sourceSize, long long sourceTime, int nverts, int directions,
+    int mapSize, std::vector<float>& ao) {
+    std::ifstream in(cachefile, std::ios::binary);
+    if (!in.is_open()) return false;
+    AOCacheHeader header;
+    in.read((char*)&header, sizeof(header));
+    bool valid = in.good()
+        && !memcmp(header.magic, AO_CACHE_MAGIC, sizeof(AO_CACHE_MAGIC))
+        && header.endian == AO_CACHE_ENDIAN
+        && header.version == AO_CACHE_VERSION
+        && header.sourceSize == sourceSize
+        && header.sourceTime == sourceTime
+        && header.nverts == nverts
+        && header.directions == directions
+        && header.mapSize == mapSize;
+    if (!valid) return false;
+    ao.resize(nverts);
+    in.read((char*)ao.data(), sizeof(float) * nverts);
+    return in.good();
+}
+
+static void writeAOCache(const std::string& cachefile, long long sourceSize, long long sourceTime, int directions, int mapSize,
+    const std::vector<float>& ao) {
+    AOCacheHeader header;
+    memset((void*)&header, 0, sizeof(header));
+    memcpy(header.magic, AO_CACHE_MAGIC, sizeof(AO_CACHE_MAGIC));
+    header.endian = AO_CACHE_ENDIAN;
+    header.version = AO_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.nverts = (int)ao.size();
+    header.directions = directions;
+    header.mapSize = mapSize;
+    //Same temporary file and rename as the mesh cache
+    std::string tmpfile = tempFileName(cachefile);
+    std::ofstream out(tmpfile, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't write ao cache " << cachefile << "\n";
+        return;
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)ao.data(), sizeof(float) * ao.size());
+    bool good = out.good();
+    out.close();
+    std::remove(cachefile.c_str());
+    if (!good || std::rename(tmpfile.c_str(), cachefile.c_str()) != 0) {
+        std::remove(tmpfile.c_str());
+        std::cerr << "can't write ao cache " << cachefile << "\n";
+    }
+}
+
+bool loadAO(Model* model, const std::string& filename, ThreadPool& pool) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return false;
+    std::string cachefile = replaceExtension(filename, ".zao");
+    const int directions = 128;
+    const int mapSize = 512;
+    std::vector<float> ao;
+    if (readAOCache(cachefile, (long long)st.st_size, (long long)st.st_mtime, model->nverts(), directions, mapSize, ao)) {
+        std::cerr << "ao cache " << cachefile << " loaded" << std::endl;
+    }
+    else {
+        if (!bakeAO(model, pool, ao, directions, mapSize)) return false;
+        writeAOCache(cachefile, (long long)st.st_size, (long long)st.st_mtime, directions, mapSize, ao);
+        std::cerr << "ao baked into " << cachefile << std::endl;
+    }
+    model->setAO(ao);
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Model;
+class ThreadPool;
+
+//Per-vertex ambient occlusion: the model is rendered into a depth map from each of `directions`
+//directions spread over the sphere, and every vertex averages the cosine weighted visibility of
+//the directions above its normal. Depth maps render on the pool, vertices are resolved in parallel
+bool bakeAO(Model* model, ThreadPool& pool, std::vector<float>& ao, int directions = 128, int mapSize = 512);
+
+//Attaches the occlusion to the model, read from <stem>.zao next to the .obj when it matches the .obj
+//size and mtime and was baked with the same directions and map size, otherwise baked and written
+//there for the next run
+bool loadAO(Model* model, const std::string& filename, ThreadPool& pool);
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "tgaimage.h"
+#include "model.h"
+#include "gl.h"
+#include "shader.h"
+#include "mappedfile.h"
+#include "objparser.h"
+#include "shadowmap.h"
+
+//Built separately from main.cpp: every .cpp except main.cpp
+//usage: benchmark [model.obj] [frames]
+//       benchmark -suite [-format csv|json] [-repeats n] [-sizes 512,1024,2000]
+const int width = 2000;
+const int height = 2000;
+Vec3f lightDir(0.3, -0.7, -1);
+Vec3f camera(0.25, 0.3, 2);
+Vec3f center(0, 0, 0);
+Vec3f viewDir = center - camera;
+float ambient = 0.1f;
+
+static double timeFrames(Model* model, Shader& shader, int frames) {
+    Framebuffer framebuffer(width, height);
+    ZBuffer zbuffer(width, height);
+    double best = 1e30;
+    for (int i = 0; i < frames; i++) {
+        framebuffer.clear();
+        zbuffer.clear();
+        auto start = std::chrono::steady_clock::now();
+        drawModel(model, shader, framebuffer, zbuffer);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+static void benchShader(const char* name, Model* model, Shader& shader, int frames) {
+    shader.setSpecialized(false);
+    double virtualMs = timeFrames(model, shader, frames);
+    shader.setSpecialized(true);
+    double specializedMs = timeFrames(model, shader, frames);
+    std::cout << name << "\tvirtual " << virtualMs << " ms\tspecialized " << specializedMs << " ms\tspeedup "
+        << virtualMs / specializedMs << "x" << std::endl;
+}
+
+static void benchParse(const std::string& path, int threads, int repeats) {
+    MappedFile file;
+    if (!file.open(path)) return;
+    ThreadPool pool(threads);
+    double best = 1e30;
+    for (int i = 0; i < repeats; i++) {
+        ObjData obj;
+        auto start = std::chrono::steady_clock::now();
+        parseObj(file.data(), file.size(), obj, pool);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    std::cout << "parseObj\tthreads " << threads << "\t" << best * 1000.0 << " ms\t" << file.size() / best / (1 << 20) << " MB/s" << std::endl;
+}
+
+//Shadow map pass against the full Blinn-Phong pass it is meant to be a small fraction of
+static void benchDepth(Model* model, Shader& shader, int frames) {
+    ThreadPool pool;
+    Framebuffer framebuffer(width, height);
+    ZBuffer zbuffer(width, height);
+    ShadowMap shadowMap(2048, lightDir, center, 1.0f);
+    double depthBest = 1e30, shadeBest = 1e30;
+    for (int i = 0; i < frames; i++) {
+        shadowMap.clear();
+        auto start = std::chrono::steady_clock::now();
+        shadowMap.render(model, pool);
+        std::chrono::duration<double, std::milli> depth = std::chrono::steady_clock::now() - start;
+        depthBest = std::min(depthBest, depth.count());
+        framebuffer.clear();
+        zbuffer.clear();
+        start = std::chrono::steady_clock::now();
+        drawModelTiled(model, shader, framebuffer, zbuffer, pool);
+        std::chrono::duration<double, std::milli> shade = std::chrono::steady_clock::now() - start;
+        shadeBest = std::min(shadeBest, shade.count());
+    }
+    std::cout << "drawDepth\t" << depthBest << " ms\tshaded pass " << shadeBest << " ms\t" << depthBest / shadeBest * 100.0
+        << "%" << std::endl;
+}
+
+//Turntable throughput of drawModelViews, the number that matters for batch thumbnail renders
+static void benchViews(Model* model, int views, int size, int frames) {
+    ThreadPool pool;
+    std::vector<Shader*> shaders;
+    std::vector<std::unique_ptr<Framebuffer> > framebuffers;
+    for (int v = 0; v < views; v++) {
+        float angle = 2.0f * 3.14159265f * v / views;
+        Vec3f eye = center + Vec3f(2.0f * std::sin(angle), 0.3f, 2.0f * std::cos(angle));
+        shaders.push_back(new BlinnPhongShader(getViewport(size, size), getProjection(eye, center), getView(eye, center, Vec3f(0, 1.0f, 0)),
+            lightDir, model->getTexture(), ambient, center - eye, model->getSpecular(), 64.0f, model->getNormal()));
+        framebuffers.emplace_back(new Framebuffer(size, size));
+    }
+    double best = 1e30;
+    for (int i = 0; i < frames; i++) {
+        for (std::unique_ptr<Framebuffer>& framebuffer : framebuffers) framebuffer->clear();
+        auto start = std::chrono::steady_clock::now();
+        drawModelViews(model, shaders, framebuffers, pool);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    std::cout << "drawModelViews\t" << views << " views " << size << "x" << size << "\t" << best * 1000.0 << " ms\t"
+        << views / best << " views/s" << std::endl;
+    for (Shader* shader : shaders) delete shader;
+}
+
+//Stage suite: every stage of the pipeline timed on its own over the bundled scenes and several
+//resolutions, each repeated and reported with its spread so a pipeline can gate on regressions
+struct StageResult {
+    std::string scene;
+    int size;
+    std::string stage;
+    std::vector<double> ms;
+};
+
+struct Scene {
+    const char* name;
+    std::vector<std::string> parts;
+};
+
+template<class F>
+static std::vector<double> timeRepeats(int repeats, F run) {
+    std::vector<double> ms;
+    for (int i = 0; i < repeats; i++) {
+        ms.push_back(run());
+    }
+    return ms;
+}
+
+//Times body() alone after setup(), in milliseconds
+template<class Setup, class Body>
+static double timeStage(Setup setup, Body body) {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static void stageStats(const std::vector<double>& ms, double& min, double& median, double& mean, double& stddev, double& max) {
+    std::vector<double> sorted(ms);
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    min = sorted.front();
+    max = sorted.back();
+    median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+    mean = 0.0;
+    for (double v : sorted) mean += v;
+    mean /= n;
+    stddev = 0.0;
+    for (double v : sorted) stddev += (v - mean) * (v - mean);
+    stddev = n > 1 ? std::sqrt(stddev / (n - 1)) : 0.0;
+}
+
+static void writeResults(const std::vector<StageResult>& results, bool json, std::ostream& out) {
+    if (json) out << "[\n";
+    else out << "scene,size,stage,repeats,min_ms,median_ms,mean_ms,stddev_ms,max_ms\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StageResult& r = results[i];
+        double min, median, mean, stddev, max;
+        stageStats(r.ms, min, median, mean, stddev, max);
+        if (json) {
+            out << "  {\"scene\": \"" << r.scene << "\", \"size\": " << r.size << ", \"stage\": \"" << r.stage
+                << "\", \"repeats\": " << r.ms.size() << ", \"min_ms\": " << min << ", \"median_ms\": " << median
+                << ", \"mean_ms\": " << mean << ", \"stddev_ms\": " << stddev << ", \"max_ms\": " << max << ", \"samples_ms\": [";
+            for (size_t k = 0; k < r.ms.size(); k++) out << (k ? ", " : "") << r.ms[k];
+            out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        else {
+            out << r.scene << "," << r.size << "," << r.stage << "," << r.ms.size() << "," << min << "," << median << ","
+                << mean << "," << stddev << "," << max << "\n";
+        }
+    }
+    if (json) out << "]\n";
+}
+
+static Shader* createShader(const std::string& name, Model* model, const Matrix& viewport, const Matrix& projection,
+    const Matrix& view, const Vec3f& eye) {
+    if (name == "flat") return new FlatShader(viewport, projection, view, lightDir, model->getTexture());
+    if (name == "gouraud") return new GouraudShader(viewport, projection, view, lightDir, model->getTexture());
+    if (name == "toon") return new ToonShader(viewport, projection, view, lightDir);
+    if (name == "phong") return new PhongShader(viewport, projection, view, lightDir, model->getTexture(), ambient, center - eye,
+        model->getSpecular(), 64.0f, model->getNormal());
+    return new BlinnPhongShader(viewport, projection, view, lightDir, model->getTexture(), ambient, center - eye,
+        model->getSpecular(), 64.0f, model->getNormal());
+}
+
+static void benchSuite(const std::vector<int>& sizes, int repeats, std::vector<StageResult>& results) {
+    std::vector<Scene> scenes = {
+        { "african_head", { "obj/african_head/african_head.obj", "obj/african_head/african_head_eye_inner.obj" } },
+        { "boggie", { "obj/boggie/body.obj", "obj/boggie/head.obj", "obj/boggie/eyes.obj" } },
+        { "diablo3_pose", { "obj/diablo3_pose/diablo3_pose.obj" } },
+    };
+    const char* textureSuffixes[] = { "_diffuse.tga", "_nm_tangent.tga", "_spec.tga" };
+    const char* shaderNames[] = { "flat", "gouraud", "toon", "phong", "blinnphong" };
+    ThreadPool pool;
+    for (const Scene& scene : scenes) {
+        //Resident copies keep the textures in the cache, so the parse stage times only the OBJ
+        std::vector<std::unique_ptr<Model> > models;
+        std::vector<Model*> parts;
+        for (const std::string& path : scene.parts) {
+            models.emplace_back(new Model(path, false, &pool));
+            if (!models.back()->isActive()) {
+                std::cerr << "can't load " << path << ", skipping " << scene.name << std::endl;
+                parts.clear();
+                break;
+            }
+            parts.push_back(models.back().get());
+        }
+        if (parts.empty()) continue;
+        results.push_back({ scene.name, 0, "parse", timeRepeats(repeats, [&]() {
+            return timeStage([]() {}, [&]() {
+                for (const std::string& path : scene.parts) Model model(path, false, &pool);
+            });
+        }) });
+        std::vector<std::string> textures;
+        for (const std::string& path : scene.parts) {
+            for (const char* suffix : textureSuffixes) {
+                std::string file = path.substr(0, path.find_last_of('.')) + suffix;
+                if (std::ifstream(file).good()) textures.push_back(file);
+            }
+        }
+        results.push_back({ scene.name, 0, "texture_load", timeRepeats(repeats, [&]() {
+            return timeStage([]() {}, [&]() {
+                for (const std::string& file : textures) {
+                    TGAImage image;
+                    image.read_tga_file(file.c_str(), TGAImage::BOTTOM_UP);
+                }
+            });
+        }) });
+        for (int size : sizes) {
+            Matrix viewport = getViewport(size, size);
+            Matrix projection = getProjection(camera, center);
+            Matrix view = getView(camera, center, Vec3f(0, 1.0f, 0));
+            std::vector<Shader*> rasterShaders;
+            for (Model* part : parts) rasterShaders.push_back(createShader("blinnphong", part, viewport, projection, view, camera));
+            Matrix mvp = *rasterShaders[0]->getMVP();
+            VertexCache cache;
+            results.push_back({ scene.name, size, "transform", timeRepeats(repeats, [&]() {
+                return timeStage([]() {}, [&]() {
+                    for (Model* part : parts) cache.transform(part, mvp, pool);
+                });
+            }) });
+            //Depth and visibility only, the fragment stages below shade what this leaves behind
+            VisibilityBuffer vbuffer(size, size);
+            ZBuffer zbuffer(size, size);
+            results.push_back({ scene.name, size, "rasterize", timeRepeats(repeats, [&]() {
+                return timeStage([&]() { vbuffer.clear(); zbuffer.clear(); }, [&]() {
+                    for (int draw = 0; draw < (int)parts.size(); draw++)
+                        drawModelVisibility(parts[draw], draw, *rasterShaders[draw], vbuffer, zbuffer, pool);
+                });
+            }) });
+            Framebuffer framebuffer(size, size);
+            for (const char* name : shaderNames) {
+                std::vector<Shader*> shaders;
+                for (Model* part : parts) shaders.push_back(createShader(name, part, viewport, projection, view, camera));
+                results.push_back({ scene.name, size, std::string("fragment_") + name, timeRepeats(repeats, [&]() {
+                    return timeStage([&]() { framebuffer.clear(); }, [&]() {
+                        shadeVisibility(parts, shaders, vbuffer, framebuffer, pool);
+                    });
+                }) });
+                for (Shader* shader : shaders) delete shader;
+            }
+            TGAImage image(size, size, TGAImage::RGB);
+            framebuffer.toImage(image);
+            results.push_back({ scene.name, size, "write_tga", timeRepeats(repeats, [&]() {
+                return timeStage([]() {}, [&]() { image.write_tga_file("benchmark.tga"); });
+            }) });
+            std::remove("benchmark.tga");
+            for (Shader* shader : rasterShaders) delete shader;
+        }
+    }
+}
+
+static int runSuite(int argc, char** argv) {
+    bool json = false;
+    int repeats = 5;
+    std::vector<int> sizes = { 512, 1024, 2000 };
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-format" && i + 1 < argc) json = std::string(argv[++i]) == "json";
+        else if (arg == "-repeats" && i + 1 < argc) repeats = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "-sizes" && i + 1 < argc) {
+            sizes.clear();
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ',')) {
+                if (!size.empty()) sizes.push_back(std::stoi(size));
+            }
+        }
+        else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    //Loader chatter goes to stderr, the results alone to stdout
+    std::vector<StageResult> results;
+    benchSuite(sizes, repeats, results);
+    writeResults(results, json, std::cout);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "-suite") return runSuite(argc, argv);
+    std::string path = argc > 1 ? argv[1] : "obj/african_head/african_head.obj";
+    int frames = argc > 2 ? std::stoi(argv[2]) : 5;
+    benchParse(path, 1, frames);
+    benchParse(path, 0, frames);
+    Model model(path, false);
+    if (!model.isActive()) {
+        std::cerr << "can't load " << path << std::endl;
+        return 1;
+    }
+    Matrix viewport = getViewport(width, height);
+    Matrix projection = getProjection(camera, center);
+    Matrix view = getView(camera, center, Vec3f(0, 1.0f, 0));
+    Texture texture = model.getTexture();
+    Texture specularMap = model.getSpecular();
+    Texture normalMap = model.getNormal();
+
+    FlatShader flat(viewport, projection, view, lightDir, texture);
+    GouraudShader gouraud(viewport, projection, view, lightDir, texture);
+    ToonShader toon(viewport, projection, view, lightDir);
+    PhongShader phong(viewport, projection, view, lightDir, texture, ambient, viewDir, specularMap, 64.0f, normalMap);
+    BlinnPhongShader blinnPhong(viewport, projection, view, lightDir, texture, ambient, viewDir, specularMap, 64.0f, normalMap);
+    benchShader("FlatShader", &model, flat, frames);
+    benchShader("GouraudShader", &model, gouraud, frames);
+    benchShader("ToonShader", &model, toon, frames);
+    benchShader("PhongShader", &model, phong, frames);
+    benchShader("BlinnPhongShader", &model, blinnPhong, frames);
+    benchDepth(&model, blinnPhong, frames);
+    benchViews(&model, 32, 512, frames);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Index of the lowest set bit, v must not be 0
+inline int countTrailingZeros(unsigned int v) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return (int)index;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+//Number of set bits
+inline int popCount(unsigned int v) {
+#ifdef _MSC_VER
+    return (int)__popcnt(v);
+#else
+    return __builtin_popcount(v);
+#endif
+}
@@ -0,0 +1,59 @@
+#include <emmintrin.h>
+#include <new>
+#include <string.h>
+#include "framebuffer.h"
+
+Framebuffer::Framebuffer(int w, int h, Origin origin) : width(w), height(h), origin(origin) {
+    //16 pixels are 64 bytes, so every row starts on a cache line
+    stride = (width + 15) & ~15;
+    data = (unsigned int*)_mm_malloc((size_t)stride * height * sizeof(unsigned int), 64);
+    //Fails the same way new would
+    if (!data) throw std::bad_alloc();
+    first = origin == ORIGIN_BOTTOM_LEFT ? data + (size_t)(height - 1) * stride : data;
+    step = origin == ORIGIN_BOTTOM_LEFT ? -stride : stride;
+    clear();
+}
+
+Framebuffer::~Framebuffer() {
+    _mm_free(data);
+}
+
+void Framebuffer::clear(unsigned int color) {
+    //Rows are padded to whole 16 byte stores, so the buffer is one aligned run of them
+    const __m128i value = _mm_set1_epi32((int)color);
+    __m128i* p = (__m128i*)data;
+    __m128i* end = (__m128i*)(data + (size_t)stride * height);
+    for (; p < end; p += 4) {
+        _mm_store_si128(p, value);
+        _mm_store_si128(p + 1, value);
+        _mm_store_si128(p + 2, value);
+        _mm_store_si128(p + 3, value);
+    }
+}
+
+void Framebuffer::toImage(TGAImage& image) const {
+    int bytespp = image.get_bytespp() ? image.get_bytespp() : (int)TGAImage::RGB;
+    if (image.get_width() != width || image.get_height() != height) image = TGAImage(width, height, bytespp);
+    unsigned char* out = image.buffer();
+    for (int y = 0; y < height; y++) {
+        const unsigned int* src = scanline(y);
+        unsigned char* dst = out + (size_t)y * width * bytespp;
+        if (bytespp == TGAImage::RGBA) {
+            memcpy(dst, src, width * 4);
+        }
+        else if (bytespp == TGAImage::RGB) {
+            for (int x = 0; x < width; x++, dst += 3) {
+                dst[0] = (unsigned char)src[x];
+                dst[1] = (unsigned char)(src[x] >> 8);
+                dst[2] = (unsigned char)(src[x] >> 16);
+            }
+        }
+        else {
+            //Grayscale keeps the luma
+            for (int x = 0; x < width; x++) {
+                unsigned int c = src[x];
+                dst[x] = (unsigned char)(((c & 0xff) * 29 + (c >> 8 & 0xff) * 150 + (c >> 16 & 0xff) * 77) >> 8);
+            }
+        }
+    }
+}
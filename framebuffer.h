@@ -0,0 +1,50 @@
+#pragma once
+
+#include "tgaimage.h"
+
+//Which screen corner row 0 of the viewport is, bottom-left matches getViewport()
+enum Origin {
+    ORIGIN_BOTTOM_LEFT, ORIGIN_TOP_LEFT
+};
+
+//Render target of the rasterizer: packed 32 bit bgra pixels, rows padded to 64 bytes and stored
+//top-down, so with the origin at the bottom-left the viewport writes rows already in output order.
+//set() is unchecked, callers clip to the buffer first
+class Framebuffer {
+private:
+    unsigned int* data;
+    //Address of viewport row 0 and the distance to the next row, negative for a bottom-left origin
+    unsigned int* first;
+    int step;
+    int width;
+    int height;
+    int stride;
+    Origin origin;
+public:
+    Framebuffer(int w, int h, Origin origin = ORIGIN_BOTTOM_LEFT);
+    Framebuffer(const Framebuffer&) = delete;
+    Framebuffer& operator =(const Framebuffer&) = delete;
+    ~Framebuffer();
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    //Pixels between the starts of two memory rows
+    int getStride() const { return stride; }
+    Origin getOrigin() const { return origin; }
+    //Viewport row y
+    unsigned int* row(int y) { return first + y * step; }
+    const unsigned int* row(int y) const { return first + y * step; }
+    //Memory row y, top of the output image first
+    const unsigned int* scanline(int y) const { return data + y * stride; }
+    void set(int x, int y, unsigned int color) { row(y)[x] = color; }
+    void set(int x, int y, const TGAColor& color) { row(y)[x] = pack(color); }
+    unsigned int get(int x, int y) const { return row(y)[x]; }
+    //Packs a shader color, the framebuffer is opaque so alpha is always 255
+    static unsigned int pack(const TGAColor& color) {
+        return color.bgra[0] | color.bgra[1] << 8 | color.bgra[2] << 16 | 0xff000000u;
+    }
+    //Opaque black by default
+    void clear(unsigned int color = 0xff000000u);
+    //Copies the pixels into image top row first, ready for write_tga_file() without a flip;
+    //image is reallocated when its size differs, its format is kept
+    void toImage(TGAImage& image) const;
+};
@@ -0,0 +1,133 @@
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include "framestream.h"
+
+FrameStream::FrameStream(int fd, FrameFormat format, int w, int h) : fd(fd), format(format), back(0), pending(-1),
+    stop(false), failed(false), error(0) {
+    for (int i = 0; i < 2; i++) frames[i].reset(new Framebuffer(w, h));
+    line.resize(w * 4);
+    writer = std::thread(&FrameStream::loop, this);
+}
+
+FrameStream::~FrameStream() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending < 0; });
+        stop = true;
+    }
+    wake.notify_one();
+    writer.join();
+}
+
+Framebuffer& FrameStream::frame() {
+    return *frames[back];
+}
+
+bool FrameStream::submit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    //Only one frame is in flight, the one before has to be out before this one is queued
+    done.wait(lock, [this]() { return pending < 0; });
+    pending = back;
+    back ^= 1;
+    wake.notify_one();
+    return !failed;
+}
+
+bool FrameStream::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return pending < 0; });
+    return !failed;
+}
+
+int FrameStream::getError() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return error;
+}
+
+bool FrameStream::parseFormat(const std::string& name, FrameFormat& format) {
+    if (name == "rgb") format = FRAME_RGB;
+    else if (name == "rgba") format = FRAME_RGBA;
+    else if (name == "ppm") format = FRAME_PPM;
+    else if (name == "tga") format = FRAME_TGA;
+    else return false;
+    return true;
+}
+
+void FrameStream::loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stop || pending >= 0; });
+        if (pending < 0) return;
+        const Framebuffer& frame = *frames[pending];
+        bool skip = failed;
+        lock.unlock();
+        bool ok = skip || writeFrame(frame);
+        lock.lock();
+        if (!ok) failed = true;
+        pending = -1;
+        done.notify_all();
+    }
+}
+
+bool FrameStream::writeAll(const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+#ifdef _WIN32
+        int n = _write(fd, p, (unsigned int)std::min(size, (size_t)1 << 30));
+#else
+        ssize_t n = ::write(fd, p, size);
+#endif
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error = n < 0 ? errno : EIO;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool FrameStream::writeFrame(const Framebuffer& frame) {
+    int w = frame.getWidth(), h = frame.getHeight();
+    if (format == FRAME_TGA) {
+        //32 bit top-left TGA is the framebuffer's own layout, rows go out without conversion
+        TGA_Header header;
+        memset(&header, 0, sizeof(header));
+        header.datatypecode = 2;
+        header.bitsperpixel = 32;
+        header.width = w;
+        header.height = h;
+        header.imagedescriptor = 0x28;
+        if (!writeAll(&header, sizeof(header))) return false;
+        if (frame.getStride() == w) return writeAll(frame.scanline(0), (size_t)w * h * 4);
+        for (int y = 0; y < h; y++) {
+            if (!writeAll(frame.scanline(y), w * 4)) return false;
+        }
+        return true;
+    }
+    if (format == FRAME_PPM) {
+        std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+        if (!writeAll(header.data(), header.size())) return false;
+    }
+    //Raw formats are RGB(A) byte order, swizzled one scanline at a time
+    int channels = format == FRAME_RGBA ? 4 : 3;
+    for (int y = 0; y < h; y++) {
+        const unsigned int* src = frame.scanline(y);
+        unsigned char* dst = line.data();
+        for (int x = 0; x < w; x++, dst += channels) {
+            dst[0] = (unsigned char)(src[x] >> 16);
+            dst[1] = (unsigned char)(src[x] >> 8);
+            dst[2] = (unsigned char)src[x];
+            if (channels == 4) dst[3] = (unsigned char)(src[x] >> 24);
+        }
+        if (!writeAll(line.data(), w * channels)) return false;
+    }
+    return true;
+}
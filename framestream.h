@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "framebuffer.h"
+
+enum FrameFormat {
+    FRAME_RGB, FRAME_RGBA, FRAME_PPM, FRAME_TGA
+};
+
+//Writes rendered frames back to back to a file descriptor, e.g. stdout piped into a video encoder.
+//Two frames are kept: the caller renders into frame() while the previous one is written on a
+//background thread. Framebuffer rows are already stored top row first, so nothing is flipped
+class FrameStream {
+private:
+    int fd;
+    FrameFormat format;
+    std::unique_ptr<Framebuffer> frames[2];
+    int back;
+    //Frame waiting to be written or being written, -1 when the writer is idle
+    int pending;
+    bool stop;
+    bool failed;
+    //errno of the write that failed, e.g. EPIPE once the reader closed the pipe
+    int error;
+    std::vector<unsigned char> line;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::thread writer;
+
+    void loop();
+    bool writeFrame(const Framebuffer& frame);
+    bool writeAll(const void* data, size_t size);
+public:
+    FrameStream(int fd, FrameFormat format, int w, int h);
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator =(const FrameStream&) = delete;
+    //Waits for the last frame to be written
+    ~FrameStream();
+    //Framebuffer to render the next frame into
+    Framebuffer& frame();
+    //Queues frame() for writing and returns once the other buffer is free to render into,
+    //false if an earlier write failed
+    bool submit();
+    //Blocks until every submitted frame is written
+    bool flush();
+    //errno of the failed write, 0 while every write succeeded
+    int getError();
+    //rgb, rgba, ppm or tga, returns false for anything else
+    static bool parseFormat(const std::string& name, FrameFormat& format);
+};
@@ -1,4 +1,10 @@
+#include <cmath>
+#include <emmintrin.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
 #include "gl.h"
+#include "bits.h"
 
 Matrix getViewport(int w, int h) {
     Matrix m = Matrix::Identity();
@@ -98,33 +104,743 @@ Vec3f barycentric(Vec3f A, Vec3f B, Vec3f C, Vec3f P) {
     return Vec3f(-1, 1, 1);
 }
 
-void triangleBoundingBox(Vec3f* verts, Shader& shader, TGAImage& image, float* zbuffer) {
-    Vec2f bboxmin(image.get_width(), image.get_height());
-    Vec2f bboxmax(0.0f, 0.0f);
+static void boundingBox(Vec3f* verts, int width, int height, Vec2f& bboxmin, Vec2f& bboxmax) {
+    bboxmin = Vec2f(width, height);
+    bboxmax = Vec2f(0.0f, 0.0f);
     for (int i = 0; i < 3; i++) {
         bboxmin.x() = std::max(0.0f, std::min(verts[i].x(), bboxmin.x()));
         bboxmin.y() = std::max(0.0f, std::min(verts[i].y(), bboxmin.y()));
-        bboxmax.x() = std::min(1.0f * image.get_width(), std::max(verts[i].x(), bboxmax.x()));
-        bboxmax.y() = std::min(1.0f * image.get_height(), std::max(verts[i].y(), bboxmax.y()));
-    }
-    for (int x = bboxmin.x(); x <= bboxmax.x(); x++) {
-        for (int y = bboxmin.y(); y <= bboxmax.y(); y++) {
-            Vec3f P(x, y, 0.0f);
-            Vec3f bc = barycentric(verts[0], verts[1], verts[2], P);
-            if (bc[0] < 0 || bc[1] < 0 || bc[2] < 0) continue;
+        bboxmax.x() = std::min(1.0f * width, std::max(verts[i].x(), bboxmax.x()));
+        bboxmax.y() = std::min(1.0f * height, std::max(verts[i].y(), bboxmax.y()));
+    }
+}
+
+//Rounds x and y to the SUBPIXEL_BITS grid, every stage that looks at screen positions uses the snapped ones
+static Vec3f snapVertex(const Vec3f& v) {
+    const float scale = (float)(1 << SUBPIXEL_BITS);
+    return Vec3f(std::nearbyint(v.x() * scale) / scale, std::nearbyint(v.y() * scale) / scale, v.z());
+}
+
+//Integer triangle setup: with x, y in sub-pixels E[i](x, y) = A[i] * x + B[i] * y + C[i] is the doubled area of
+//the edge opposite vertex i, exact for snapped vertices. Top-left rule: a sample exactly on an edge belongs to the
+//triangle only if the edge is a top edge (horizontal with the inside below) or a left edge, so two triangles
+//sharing an edge never both cover it
+struct TriangleEdges {
+    long long A[3], B[3], C[3];
+    //Smallest E[i] that is inside, 0 on top-left edges and 1 on the others
+    long long bias[3];
+    long long area;
+    Vec3f snapped[3];
+    //Depth plane z = zA * x + zB * y + zC in pixels
+    float zA, zB, zC;
+
+    //False for back-facing and zero area triangles
+    bool setup(const Vec3f* verts) {
+        const float scale = (float)(1 << SUBPIXEL_BITS);
+        long long fx[3], fy[3];
+        for (int i = 0; i < 3; i++) {
+            snapped[i] = snapVertex(verts[i]);
+            fx[i] = (long long)(snapped[i].x() * scale);
+            fy[i] = (long long)(snapped[i].y() * scale);
+        }
+        area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fx[2] - fx[0]) * (fy[1] - fy[0]);
+        if (area <= 0) return false;
+        for (int i = 0; i < 3; i++) {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            A[i] = fy[a] - fy[b];
+            B[i] = fx[b] - fx[a];
+            C[i] = fx[a] * fy[b] - fy[a] * fx[b];
+            //Counter-clockwise with y up: left edges run down, top edges run right to left
+            bool topLeft = A[i] > 0 || (A[i] == 0 && B[i] < 0);
+            bias[i] = topLeft ? 0 : 1;
+        }
+        //From the exact coefficients rather than float cross products, which lose thin triangles
+        double dzx = 0.0, dzy = 0.0;
+        for (int i = 0; i < 3; i++) {
+            dzx += (double)snapped[i].z() * A[i] * scale / area;
+            dzy += (double)snapped[i].z() * B[i] * scale / area;
+        }
+        zA = (float)dzx;
+        zB = (float)dzy;
+        zC = (float)(snapped[0].z() - dzx * snapped[0].x() - dzy * snapped[0].y());
+        return true;
+    }
+    //E[i] at sub-pixel position (sx, sy)
+    long long at(int i, long long sx, long long sy) const {
+        return A[i] * sx + B[i] * sy + C[i];
+    }
+};
+
+//Rasterizes the triangle inside [x0, x1) x [y0, y1), writes the depth of every visible pixel
+//and hands it to fragment(x, y, bc); weights, when given, maps bc back to the unclipped face.
+//DepthEqual is the shading pass after a Z-prepass: only pixels whose depth equals the stored one
+//pass, and nothing is written to the zbuffer
+template<bool DepthEqual = false, class Fragment>
+static void rasterize(Vec3f* verts, ZBuffer& zbuffer, int x0, int y0, int x1, int y1, Fragment& fragment,
+    const Eigen::Matrix3f* weights = nullptr) {
+    TriangleEdges edges;
+    if (!edges.setup(verts)) return;
+    const Vec3f* snapped = edges.snapped;
+    int width = zbuffer.getWidth();
+    //Pixel centers are at integer positions, only those inside the snapped box can be covered
+    float minx = std::min(snapped[0].x(), std::min(snapped[1].x(), snapped[2].x()));
+    float maxx = std::max(snapped[0].x(), std::max(snapped[1].x(), snapped[2].x()));
+    float miny = std::min(snapped[0].y(), std::min(snapped[1].y(), snapped[2].y()));
+    float maxy = std::max(snapped[0].y(), std::max(snapped[1].y(), snapped[2].y()));
+    int xmin = std::max(std::max(x0, 0), (int)std::ceil(minx)), xmax = std::min(std::min(x1, width) - 1, (int)std::floor(maxx));
+    int ymin = std::max(std::max(y0, 0), (int)std::ceil(miny)), ymax = std::min(std::min(y1, zbuffer.getHeight()) - 1, (int)std::floor(maxy));
+    if (xmin > xmax || ymin > ymax) return;
+    const long long one = 1LL << SUBPIXEL_BITS;
+    //Edge steps per pixel, they stay far inside 32 bits for anything within the guard band
+    long long stepX[3], stepY[3];
+    for (int i = 0; i < 3; i++) {
+        stepX[i] = edges.A[i] * one;
+        stepY[i] = edges.B[i] * one;
+    }
+    float invArea = 1.0f / (float)edges.area;
+    float zA = edges.zA, zB = edges.zB, zC = edges.zC;
+    //Counted locally and added to the thread's stats once per triangle
+    bool stats = collectStats;
+    long long tested = 0, passed = 0;
+    float vzmin = std::min(verts[0].z(), std::min(verts[1].z(), verts[2].z()));
+    float vzmax = std::max(verts[0].z(), std::max(verts[1].z(), verts[2].z()));
+    float* depthBuffer = zbuffer.buffer();
+    const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    for (int by = ymin & ~(RASTER_BLOCK - 1); by <= ymax; by += RASTER_BLOCK) {
+        for (int bx = xmin & ~(RASTER_BLOCK - 1); bx <= xmax; bx += RASTER_BLOCK) {
+            //Edge functions are linear, so the block corners decide whether the whole block is outside or inside
+            bool reject = false, accept = true;
+            long long corner[3];
+            for (int i = 0; i < 3 && !reject; i++) {
+                corner[i] = edges.at(i, bx * one, by * one);
+                long long dx = stepX[i] * (RASTER_BLOCK - 1), dy = stepY[i] * (RASTER_BLOCK - 1);
+                long long emin = corner[i] + std::min(0LL, dx) + std::min(0LL, dy);
+                long long emax = corner[i] + std::max(0LL, dx) + std::max(0LL, dy);
+                if (emax < edges.bias[i]) reject = true;
+                if (emin < edges.bias[i]) accept = false;
+            }
+            if (reject) continue;
+            //Coarse depth test: skip blocks where the triangle is behind everything already written,
+            //and drop the per-pixel depth load where it is in front of everything
+            int zbx = bx / ZBUFFER_BLOCK, zby = by / ZBUFFER_BLOCK;
+            float zc = zA * bx + zB * by + zC;
+            float dzx = zA * (RASTER_BLOCK - 1), dzy = zB * (RASTER_BLOCK - 1);
+            float tzmax = std::min(vzmax, zc + std::max(0.0f, dzx) + std::max(0.0f, dzy));
+            //Pixels on the edges of thin triangles can step past these bounds, which is harmless for a less test
+            //but would drop exact matches, so the equal pass only uses the per-pixel test
+            if (!DepthEqual && tzmax <= zbuffer.getBlockMin(zbx, zby)) continue;
+            float tzmin = std::max(vzmin, zc + std::min(0.0f, dzx) + std::min(0.0f, dzy));
+            bool depthAccept = !DepthEqual && tzmin > zbuffer.getBlockMax(zbx, zby);
+            bool written = false;
+            int rx0 = std::max(bx, xmin), rx1 = std::min(bx + RASTER_BLOCK - 1, xmax);
+            int ry0 = std::max(by, ymin), ry1 = std::min(by + RASTER_BLOCK - 1, ymax);
+            //Inside the block the edges are kept relative to the corner, which fits 32 bit lanes; a pixel is
+            //covered when corner + rel >= bias, i.e. rel > bias - corner - 1. In a block that is not fully
+            //accepted every corner is within a block's worth of steps of the edge, so the threshold fits as well
+            __m128i row[3], threshold[3];
             for (int i = 0; i < 3; i++) {
-                P.z() += verts[i].z() * bc[i];
+                long long t = accept ? -(1LL << 30) : edges.bias[i] - corner[i] - 1;
+                threshold[i] = _mm_set1_epi32((int)std::max(-(1LL << 30), std::min(1LL << 30, t)));
+                //SSE2 has no 32 bit lane multiply, the four starting offsets are set directly
+                row[i] = _mm_setr_epi32((int)(stepX[i] * (rx0 - bx) + stepY[i] * (ry0 - by)),
+                    (int)(stepX[i] * (rx0 - bx + 1) + stepY[i] * (ry0 - by)), (int)(stepX[i] * (rx0 - bx + 2) + stepY[i] * (ry0 - by)),
+                    (int)(stepX[i] * (rx0 - bx + 3) + stepY[i] * (ry0 - by)));
+            }
+            __m128 rowZ;
+            __m128 pxf = _mm_add_ps(_mm_set1_ps((float)rx0), lanes);
+            rowZ = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), pxf), _mm_set1_ps(zB * ry0 + zC));
+            for (int y = ry0; y <= ry1; y++) {
+                __m128i e[3] = { row[0], row[1], row[2] };
+                __m128 z = rowZ;
+                for (int x = rx0; x <= rx1; x += 4) {
+                    int n = std::min(4, rx1 - x + 1);
+                    float* depth = depthBuffer + x + y * width;
+                    __m128 mask;
+                    if (depthAccept) {
+                        mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                    }
+                    else {
+                        __m128 stored;
+                        if (n == 4) {
+                            stored = _mm_loadu_ps(depth);
+                        }
+                        else {
+                            float tmp[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                            for (int l = 0; l < n; l++) tmp[l] = depth[l];
+                            stored = _mm_loadu_ps(tmp);
+                        }
+                        mask = DepthEqual ? _mm_cmpeq_ps(stored, z) : _mm_cmplt_ps(stored, z);
+                    }
+                    int lanesMask = (1 << n) - 1, inside = lanesMask;
+                    if (!accept) {
+                        __m128i in = _mm_and_si128(_mm_cmpgt_epi32(e[0], threshold[0]), _mm_cmpgt_epi32(e[1], threshold[1]));
+                        in = _mm_and_si128(in, _mm_cmpgt_epi32(e[2], threshold[2]));
+                        mask = _mm_and_ps(mask, _mm_castsi128_ps(in));
+                        inside = _mm_movemask_ps(_mm_castsi128_ps(in)) & lanesMask;
+                    }
+                    int bits = _mm_movemask_ps(mask) & lanesMask;
+                    if (stats) {
+                        tested += popCount(inside);
+                        passed += popCount(bits);
+                    }
+                    if (bits) {
+                        written = true;
+                        int ev[3][4];
+                        float zv[4];
+                        for (int i = 0; i < 3; i++) _mm_storeu_si128((__m128i*)ev[i], e[i]);
+                        _mm_storeu_ps(zv, z);
+                        for (int l = 0; l < n; l++) {
+                            if (!(bits & (1 << l))) continue;
+                            if (!DepthEqual) depth[l] = zv[l];
+                            //Barycentrics from the exact integer edges, they are never negative
+                            Vec3f bc((float)(corner[0] + ev[0][l]) * invArea, (float)(corner[1] + ev[1][l]) * invArea,
+                                (float)(corner[2] + ev[2][l]) * invArea);
+                            if (weights) bc = *weights * bc;
+                            fragment(x + l, y, bc);
+                        }
+                    }
+                    for (int i = 0; i < 3; i++) e[i] = _mm_add_epi32(e[i], _mm_set1_epi32((int)(stepX[i] * 4)));
+                    z = _mm_add_ps(z, _mm_set1_ps(zA * 4));
+                }
+                for (int i = 0; i < 3; i++) row[i] = _mm_add_epi32(row[i], _mm_set1_epi32((int)stepY[i]));
+                rowZ = _mm_add_ps(rowZ, _mm_set1_ps(zB));
+            }
+            if (written && !DepthEqual) zbuffer.updateBlock(zbx, zby);
+        }
+    }
+    if (stats) {
+        RenderCounters& counters = threadStats();
+        counters.pixelsTested += tested;
+        counters.depthPassed += passed;
+        counters.depthFailed += tested - passed;
+    }
+}
+
+//Primitive assembly: w below NEAR_W is at or behind the camera, GUARD_BAND is how many pixels a
+//triangle may reach past the viewport before it is clipped instead of left to the rasterizer
+static const float NEAR_W = 1e-3f;
+static const float GUARD_BAND = 4096.0f;
+
+enum PrimitiveResult {
+    PRIMITIVE_CULLED, PRIMITIVE_VISIBLE, PRIMITIVE_CLIPPED
+};
+
+//One piece of a clipped face, weights turns its barycentrics into the face's
+struct ClippedTriangle {
+    int face;
+    Vec3f verts[3];
+    Eigen::Matrix3f weights;
+};
+
+struct ClipVertex {
+    Vec4f pos;
+    Vec3f weight;
+};
+
+//Bit per plane the homogeneous position is outside of, for the box [xmin, xmax] x [ymin, ymax] in pixels
+static int outcode(const Vec4f& v, float xmin, float ymin, float xmax, float ymax) {
+    int code = 0;
+    if (v.x() < xmin * v.w()) code |= 1;
+    if (v.x() > xmax * v.w()) code |= 2;
+    if (v.y() < ymin * v.w()) code |= 4;
+    if (v.y() > ymax * v.w()) code |= 8;
+    if (v.w() < NEAR_W) code |= 16;
+    return code;
+}
+
+//Signed distance to clip plane p of the guard band, inside when >= 0
+static float planeDistance(const Vec4f& v, int p, int width, int height) {
+    switch (p) {
+    case 0: return v.x() + GUARD_BAND * v.w();
+    case 1: return (width + GUARD_BAND) * v.w() - v.x();
+    case 2: return v.y() + GUARD_BAND * v.w();
+    case 3: return (height + GUARD_BAND) * v.w() - v.y();
+    default: return v.w() - NEAR_W;
+    }
+}
+
+static bool frontFacing(const Vec3f* v) {
+    return (v[1].x() - v[0].x()) * (v[2].y() - v[0].y()) - (v[2].x() - v[0].x()) * (v[1].y() - v[0].y()) > 0;
+}
+
+//Culls faces outside the frustum and back faces by screen winding; faces that cross the near plane
+//or leave the guard band are clipped in homogeneous space and their pieces appended to clipped
+static PrimitiveResult assemblePrimitive(int face, const Vec4f* clip, Vec3f* screen, int width, int height,
+    std::vector<ClippedTriangle>& clipped) {
+    int inside = ~0, guard = 0;
+    for (int i = 0; i < 3; i++) {
+        inside &= outcode(clip[i], 0.0f, 0.0f, (float)width, (float)height);
+        guard |= outcode(clip[i], -GUARD_BAND, -GUARD_BAND, width + GUARD_BAND, height + GUARD_BAND);
+    }
+    if (inside) return PRIMITIVE_CULLED;
+    if (!guard) return frontFacing(screen) ? PRIMITIVE_VISIBLE : PRIMITIVE_CULLED;
+    //Sutherland-Hodgman against the planes the face crosses, 3 vertices grow by at most one per plane
+    ClipVertex poly[2][8];
+    int n = 3;
+    for (int i = 0; i < 3; i++) {
+        poly[0][i].pos = clip[i];
+        poly[0][i].weight = Vec3f::Unit(i);
+    }
+    int cur = 0;
+    //The near plane goes first, so every vertex the guard band planes see is in front of the camera
+    const int planes[5] = { 4, 0, 1, 2, 3 };
+    for (int k = 0; k < 5 && n > 0; k++) {
+        int p = planes[k];
+        if (!(guard & (1 << p))) continue;
+        ClipVertex* in = poly[cur];
+        ClipVertex* out = poly[cur ^ 1];
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            const ClipVertex& a = in[i];
+            const ClipVertex& b = in[(i + 1) % n];
+            float da = planeDistance(a.pos, p, width, height), db = planeDistance(b.pos, p, width, height);
+            if (da >= 0) out[m++] = a;
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                out[m].pos = a.pos + (b.pos - a.pos) * t;
+                //The rasterizer interpolates weights affinely on screen like unclipped faces, so a guard band
+                //cut takes its weight at the same screen position; only the near plane, where the corners
+                //behind the camera have no screen position, keeps the homogeneous parameter
+                float s = p == 4 ? t : t * b.pos.w() / ((1 - t) * a.pos.w() + t * b.pos.w());
+                out[m].weight = a.weight + (b.weight - a.weight) * s;
+                m++;
+            }
+        }
+        n = m;
+        cur ^= 1;
+    }
+    size_t first = clipped.size();
+    for (int k = 1; k + 1 < n; k++) {
+        ClippedTriangle t;
+        t.face = face;
+        int corners[3] = { 0, k, k + 1 };
+        for (int j = 0; j < 3; j++) {
+            const ClipVertex& v = poly[cur][corners[j]];
+            t.verts[j] = Vec3f(v.pos.x() / v.pos.w(), v.pos.y() / v.pos.w(), v.pos.z() / v.pos.w());
+            t.weights.col(j) = v.weight;
+        }
+        if (frontFacing(t.verts)) clipped.push_back(t);
+    }
+    return clipped.size() > first ? PRIMITIVE_CLIPPED : PRIMITIVE_CULLED;
+}
+
+//Stats for one submitted face, pieces is the number of triangles clipping produced
+static void countPrimitive(PrimitiveResult result, size_t pieces) {
+    if (!collectStats) return;
+    RenderCounters& counters = threadStats();
+    counters.facesSubmitted++;
+    if (result == PRIMITIVE_CULLED) counters.facesCulled++;
+    counters.trianglesRasterized += result == PRIMITIVE_VISIBLE ? 1 : (long long)pieces;
+}
+
+//Screen and homogeneous corners of a face before assembly, shaders without a composed MVP only
+//provide screen positions so their faces are never near clipped
+template<class S>
+static void faceCorners(Model* model, int face, S& shader, VertexCache* cache, Vec3f* screen, Vec4f* clip) {
+    for (int j = 0; j < 3; j++) {
+        if (cache) {
+            int idx = model->vertIndex(face, j);
+            screen[j] = cache->get(idx);
+            clip[j] = cache->clip(idx);
+        }
+        else {
+            screen[j] = shader.vertex(model->vert(face, j), model->uv(face, j), model->normal(face, j), j);
+            clip[j] = Vec4f(screen[j].x(), screen[j].y(), screen[j].z(), 1.0f);
+        }
+    }
+}
+
+//Calls draw(shader) with the shader cast to its concrete type, so the kernels below are compiled
+//once per built-in shader with vertex()/fragment() inlined; other shaders use the virtual calls
+template<class Draw>
+static void dispatchShader(Shader& shader, Draw draw) {
+    if (!shader.isSpecialized()) draw(shader);
+    else if (FlatShader* s = dynamic_cast<FlatShader*>(&shader)) draw(*s);
+    else if (GouraudShader* s = dynamic_cast<GouraudShader*>(&shader)) draw(*s);
+    else if (ToonShader* s = dynamic_cast<ToonShader*>(&shader)) draw(*s);
+    else if (PhongShader* s = dynamic_cast<PhongShader*>(&shader)) draw(*s);
+    else if (BlinnPhongShader* s = dynamic_cast<BlinnPhongShader*>(&shader)) draw(*s);
+    else draw(shader);
+}
+
+template<class S>
+static S* cloneShader(S& shader) {
+    return static_cast<S*>(shader.clone());
+}
+
+template<bool DepthEqual = false, class S>
+static void shadeTriangle(Vec3f* verts, S& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, int x0, int y0, int x1, int y1,
+    const Eigen::Matrix3f* weights = nullptr) {
+    long long shaded = 0, discarded = 0;
+    auto shade = [&](int x, int y, const Vec3f& bc) {
+        TGAColor color;
+        bool discard = shader.fragment(bc, color);
+        framebuffer.set(x, y, discard ? Framebuffer::pack(TGAColor(0, 0, 0)) : Framebuffer::pack(color));
+        shaded++;
+        discarded += discard;
+    };
+    rasterize<DepthEqual>(verts, zbuffer, x0, y0, x1, y1, shade, weights);
+    if (collectStats && shaded) {
+        RenderCounters& counters = threadStats();
+        counters.fragmentsShaded += shaded;
+        counters.fragmentsDiscarded += discarded;
+        counters.textureSamples += shader.takeTextureSamples();
+    }
+}
+
+//Multisampled version of shadeTriangle(): coverage and depth are tested at every sample position of the
+//pixel, but the fragment runs once per pixel and its color goes to all the samples that passed
+template<class S>
+static void shadeTriangleMSAA(Vec3f* verts, S& shader, MultisampleBuffer& msaa, int x0, int y0, int x1, int y1,
+    const Eigen::Matrix3f* weights = nullptr) {
+    TriangleEdges edges;
+    if (!edges.setup(verts)) return;
+    //Samples reach half a pixel around the pixel position, so widen the box to catch pixels covered only by them
+    Vec2f bboxmin, bboxmax;
+    boundingBox(edges.snapped, msaa.getWidth(), msaa.getHeight(), bboxmin, bboxmax);
+    int xmin = std::max(x0, (int)(bboxmin.x() - 0.5f)), xmax = std::min(x1 - 1, (int)(bboxmax.x() + 0.5f));
+    int ymin = std::max(y0, (int)(bboxmin.y() - 0.5f)), ymax = std::min(y1 - 1, (int)(bboxmax.y() + 0.5f));
+    if (xmin > xmax || ymin > ymax) return;
+    float invArea = 1.0f / (float)edges.area;
+    const long long one = 1LL << SUBPIXEL_BITS;
+    //The sample patterns are on a 1/16 grid, so with 4 sub-pixel bits every sample is an exact sub-pixel position
+    int samples = msaa.getSamples();
+    const float* offsets = msaa.getOffsets();
+    long long ox[8], oy[8];
+    for (int s = 0; s < samples; s++) {
+        ox[s] = (long long)std::nearbyint(offsets[2 * s] * one);
+        oy[s] = (long long)std::nearbyint(offsets[2 * s + 1] * one);
+    }
+    //Sample counts go into the pixel counters
+    long long tested = 0, passed = 0, shaded = 0, discarded = 0;
+    auto covered = [&](long long sx, long long sy, long long* e) {
+        for (int i = 0; i < 3; i++) {
+            e[i] = edges.at(i, sx, sy);
+            if (e[i] < edges.bias[i]) return false;
+        }
+        return true;
+    };
+    for (int y = ymin; y <= ymax; y++) {
+        for (int x = xmin; x <= xmax; x++) {
+            float* depth = msaa.depthAt(x, y);
+            unsigned int mask = 0;
+            int first = -1;
+            float sz[8];
+            long long e[3];
+            for (int s = 0; s < samples; s++) {
+                if (!covered(x * one + ox[s], y * one + oy[s], e)) continue;
+                tested++;
+                sz[s] = edges.zA * (x + offsets[2 * s]) + edges.zB * (y + offsets[2 * s + 1]) + edges.zC;
+                if (sz[s] <= depth[s]) continue;
+                mask |= 1u << s;
+                if (first < 0) first = s;
             }
-            int width = image.get_width();
-            if (zbuffer[(int)(P.x() + P.y() * width)] < P.z()) {
-                zbuffer[(int)(P.x() + P.y() * width)] = P.z();
-                TGAColor color;
-                bool discard = shader.fragment(bc, color);
-                if (!discard)
-                    image.set(P.x(), P.y(), color);
-                else
-                    image.set(P.x(), P.y(), TGAColor(0, 0, 0));
+            if (!mask) continue;
+            //Attributes at the pixel position when it is inside the triangle, otherwise at the first covered
+            //sample so they are never extrapolated past the edge
+            if (!covered(x * one, y * one, e)) covered(x * one + ox[first], y * one + oy[first], e);
+            Vec3f bc((float)e[0] * invArea, (float)e[1] * invArea, (float)e[2] * invArea);
+            if (weights) bc = *weights * bc;
+            TGAColor color;
+            bool discard = shader.fragment(bc, color);
+            if (discard) color = TGAColor(0, 0, 0);
+            passed += popCount(mask);
+            shaded++;
+            discarded += discard;
+            unsigned int packed = Framebuffer::pack(color);
+            unsigned int* samplesColor = msaa.colorAt(x, y);
+            for (int s = 0; s < samples; s++) {
+                if (!(mask & (1u << s))) continue;
+                depth[s] = sz[s];
+                samplesColor[s] = packed;
             }
         }
     }
-}
\ No newline at end of file
+    if (collectStats) {
+        RenderCounters& counters = threadStats();
+        counters.pixelsTested += tested;
+        counters.depthPassed += passed;
+        counters.depthFailed += tested - passed;
+        counters.fragmentsShaded += shaded;
+        counters.fragmentsDiscarded += discarded;
+        counters.textureSamples += shader.takeTextureSamples();
+    }
+}
+
+void triangleBoundingBox(Vec3f* verts, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer) {
+    triangleBoundingBox(verts, shader, framebuffer, zbuffer, 0, 0, framebuffer.getWidth(), framebuffer.getHeight());
+}
+
+void triangleBoundingBox(Vec3f* verts, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, int x0, int y0, int x1, int y1) {
+    shader.setup(verts);
+    shadeTriangle(verts, shader, framebuffer, zbuffer, x0, y0, x1, y1);
+}
+
+//Runs the vertex stage of one face: with a cache the positions come from it and the shader only
+//stores its per-vertex data, otherwise the shader transforms the corners itself
+template<class S>
+static void assembleFace(Model* model, int face, S& shader, VertexCache* cache, Vec3f* screenCoords) {
+    for (int j = 0; j < 3; j++) {
+        if (cache) {
+            shader.varying(model->vert(face, j), model->uv(face, j), model->normal(face, j), j);
+            screenCoords[j] = cache->get(model->vertIndex(face, j));
+        }
+        else {
+            screenCoords[j] = shader.vertex(model->vert(face, j), model->uv(face, j), model->normal(face, j), j);
+        }
+    }
+    if (model->hasAO()) {
+        for (int j = 0; j < 3; j++) shader.occlusion(model->ao(face, j), j);
+    }
+    shader.setup(screenCoords);
+}
+
+void drawModel(Model* model, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer) {
+    //Geometry and rasterization interleave per face here, so all of it is raster time
+    StageTimer timer(STAGE_RASTER);
+    VertexCache cache;
+    if (shader.getMVP()) cache.transform(model, *shader.getMVP());
+    VertexCache* vertices = shader.getMVP() ? &cache : nullptr;
+    std::vector<ClippedTriangle> clipped;
+    dispatchShader(shader, [&](auto& s) {
+        for (int i = 0; i < model->nfaces(); i++) {
+            Vec3f screenCoords[3];
+            Vec4f clip[3];
+            faceCorners(model, i, s, vertices, screenCoords, clip);
+            clipped.clear();
+            PrimitiveResult result = assemblePrimitive(i, clip, screenCoords, framebuffer.getWidth(), framebuffer.getHeight(), clipped);
+            countPrimitive(result, clipped.size());
+            if (result == PRIMITIVE_CULLED) continue;
+            assembleFace(model, i, s, vertices, screenCoords);
+            if (result == PRIMITIVE_VISIBLE)
+                shadeTriangle(screenCoords, s, framebuffer, zbuffer, 0, 0, framebuffer.getWidth(), framebuffer.getHeight());
+            for (ClippedTriangle& t : clipped)
+                shadeTriangle(t.verts, s, framebuffer, zbuffer, 0, 0, framebuffer.getWidth(), framebuffer.getHeight(), &t.weights);
+        }
+    });
+}
+
+//Vertex stage of the depth-only pass: positions come from the vertex cache and there is nothing to shade
+class DepthShader final :public Shader {
+public:
+    DepthShader(const Matrix& mvp) {
+        mvpMatrix = mvp;
+        hasMVP = true;
+    }
+    Shader* clone() {
+        return new DepthShader(*this);
+    }
+    void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+    }
+    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        return mvp(modelVertex);
+    }
+    bool fragment(Vec3f bc, TGAColor& color) {
+        return false;
+    }
+};
+
+//Skips the attribute fetches of the generic version, the depth pass only needs the cached positions
+static void assembleFace(Model* model, int face, DepthShader& shader, VertexCache* cache, Vec3f* screenCoords) {
+    for (int j = 0; j < 3; j++) screenCoords[j] = cache->get(model->vertIndex(face, j));
+}
+
+//Culls and clips the faces, bins what is left into TILE_SIZE tiles, then calls
+//drawTile(face, screenCoords, weights, shader, x0, y0, x1, y1, worker) for every triangle of every tile on the
+//pool, with the worker's own copy of the shader already loaded with the face; weights is null unless clipped.
+//A shared cache must already hold the vertices transformed by the shader's MVP; pad grows the binned box by that many pixels
+template<class S, class DrawTile>
+static void drawTiles(Model* model, S& shader, int width, int height, ThreadPool& pool, DrawTile drawTile,
+    VertexCache* shared = nullptr, float pad = 0.0f) {
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    //Faces stay in submission order inside every bin, so each pixel sees the same depth test sequence as drawModel
+    //Entries >= 0 are whole faces, -1 - k is the clipped piece k
+    std::vector<std::vector<int> > bins(tilesX * tilesY);
+    std::vector<ClippedTriangle> clipped;
+    StageTimer geometryTimer(STAGE_GEOMETRY);
+    //Every vertex is transformed once per draw and shared by the faces around it
+    VertexCache cache;
+    VertexCache* vertices = shared;
+    if (!vertices && shader.getMVP()) {
+        cache.transform(model, *shader.getMVP(), pool);
+        vertices = &cache;
+    }
+    auto bin = [&](Vec3f* verts, int entry) {
+        //Same snapped corners the rasterizer sees, so a vertex rounded across a tile edge is binned there too
+        Vec3f snapped[3] = { snapVertex(verts[0]), snapVertex(verts[1]), snapVertex(verts[2]) };
+        Vec2f bboxmin, bboxmax;
+        boundingBox(snapped, width, height, bboxmin, bboxmax);
+        int txmax = std::min(width - 1, (int)(bboxmax.x() + pad)) / TILE_SIZE;
+        int tymax = std::min(height - 1, (int)(bboxmax.y() + pad)) / TILE_SIZE;
+        for (int ty = std::max(0, (int)(bboxmin.y() - pad)) / TILE_SIZE; ty <= tymax; ty++) {
+            for (int tx = std::max(0, (int)(bboxmin.x() - pad)) / TILE_SIZE; tx <= txmax; tx++) {
+                bins[tx + ty * tilesX].push_back(entry);
+            }
+        }
+    };
+    for (int i = 0; i < model->nfaces(); i++) {
+        Vec3f screenCoords[3];
+        Vec4f clip[3];
+        faceCorners(model, i, shader, vertices, screenCoords, clip);
+        size_t first = clipped.size();
+        PrimitiveResult result = assemblePrimitive(i, clip, screenCoords, width, height, clipped);
+        if (result == PRIMITIVE_VISIBLE) bin(screenCoords, i);
+        for (size_t k = first; k < clipped.size(); k++) bin(clipped[k].verts, -1 - (int)k);
+        countPrimitive(result, clipped.size() - first);
+    }
+    geometryTimer.stop();
+    StageTimer rasterTimer(STAGE_RASTER);
+    //vertex() stores per-face state in the shader, so every worker shades with its own copy
+    std::vector<std::unique_ptr<S> > shaders(pool.size());
+    pool.parallelFor((int)bins.size(), [&](int tile, int worker) {
+        if (bins[tile].empty()) return;
+        if (!shaders[worker]) shaders[worker].reset(cloneShader(shader));
+        S& local = *shaders[worker];
+        int x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+        int x1 = std::min(width, x0 + TILE_SIZE), y1 = std::min(height, y0 + TILE_SIZE);
+        for (int entry : bins[tile]) {
+            Vec3f screenCoords[3];
+            if (entry >= 0) {
+                assembleFace(model, entry, local, vertices, screenCoords);
+                drawTile(entry, screenCoords, (const Eigen::Matrix3f*)nullptr, local, x0, y0, x1, y1, worker);
+            }
+            else {
+                ClippedTriangle& t = clipped[-1 - entry];
+                assembleFace(model, t.face, local, vertices, screenCoords);
+                drawTile(t.face, t.verts, &t.weights, local, x0, y0, x1, y1, worker);
+            }
+        }
+    });
+}
+
+void drawModelTiled(Model* model, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, ThreadPool& pool) {
+    dispatchShader(shader, [&](auto& s) {
+        drawTiles(model, s, framebuffer.getWidth(), framebuffer.getHeight(), pool,
+            [&](int face, Vec3f* screenCoords, const Eigen::Matrix3f* weights, auto& local, int x0, int y0, int x1, int y1, int worker) {
+                shadeTriangle(screenCoords, local, framebuffer, zbuffer, x0, y0, x1, y1, weights);
+            });
+    });
+}
+
+void drawModelViews(Model* model, std::vector<Shader*>& shaders, std::vector<std::unique_ptr<Framebuffer> >& framebuffers, ThreadPool& pool) {
+    //Whole views are the unit of work: each worker rasterizes its views serially into its own depth
+    //buffer, so nothing but the read-only mesh and textures is shared between threads
+    std::vector<std::unique_ptr<ZBuffer> > zbuffers(pool.size());
+    pool.parallelFor((int)shaders.size(), [&](int v, int worker) {
+        Framebuffer& framebuffer = *framebuffers[v];
+        std::unique_ptr<ZBuffer>& zbuffer = zbuffers[worker];
+        if (!zbuffer || zbuffer->getWidth() != framebuffer.getWidth() || zbuffer->getHeight() != framebuffer.getHeight())
+            zbuffer.reset(new ZBuffer(framebuffer.getWidth(), framebuffer.getHeight()));
+        else
+            zbuffer->clear();
+        drawModel(model, *shaders[v], framebuffer, *zbuffer);
+    });
+}
+
+void drawDepth(Model* model, const Matrix& mvp, ZBuffer& zbuffer, ThreadPool& pool) {
+    DepthShader shader(mvp);
+    drawTiles(model, shader, zbuffer.getWidth(), zbuffer.getHeight(), pool,
+        [&](int face, Vec3f* screenCoords, const Eigen::Matrix3f* weights, DepthShader& local, int x0, int y0, int x1, int y1, int worker) {
+            //No fragment work, the kernel reduces to edge tests and depth writes
+            auto depthOnly = [](int x, int y, const Vec3f& bc) {};
+            rasterize(screenCoords, zbuffer, x0, y0, x1, y1, depthOnly);
+        });
+}
+
+void drawModelDepth(Model* model, Shader& shader, ZBuffer& zbuffer, VertexCache& cache, ThreadPool& pool) {
+    auto drawTile = [&](int face, Vec3f* screenCoords, const Eigen::Matrix3f* weights, auto& local, int x0, int y0, int x1, int y1, int worker) {
+        auto depthOnly = [](int x, int y, const Vec3f& bc) {};
+        rasterize(screenCoords, zbuffer, x0, y0, x1, y1, depthOnly);
+    };
+    if (shader.getMVP()) {
+        cache.transform(model, *shader.getMVP(), pool);
+        DepthShader depthShader(*shader.getMVP());
+        drawTiles(model, depthShader, zbuffer.getWidth(), zbuffer.getHeight(), pool, drawTile, &cache);
+    }
+    else {
+        //Without a composed MVP only the shader's own vertex() knows the positions
+        dispatchShader(shader, [&](auto& s) {
+            drawTiles(model, s, zbuffer.getWidth(), zbuffer.getHeight(), pool, drawTile);
+        });
+    }
+}
+
+void drawModelEqual(Model* model, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, VertexCache& cache, ThreadPool& pool) {
+    dispatchShader(shader, [&](auto& s) {
+        drawTiles(model, s, framebuffer.getWidth(), framebuffer.getHeight(), pool,
+            [&](int face, Vec3f* screenCoords, const Eigen::Matrix3f* weights, auto& local, int x0, int y0, int x1, int y1, int worker) {
+                shadeTriangle<true>(screenCoords, local, framebuffer, zbuffer, x0, y0, x1, y1, weights);
+            }, shader.getMVP() ? &cache : nullptr);
+    });
+}
+
+void drawModelMSAA(Model* model, Shader& shader, MultisampleBuffer& msaa, ThreadPool& pool) {
+    //Samples sit up to half a pixel from the pixel position, so faces are binned with that much padding
+    dispatchShader(shader, [&](auto& s) {
+        drawTiles(model, s, msaa.getWidth(), msaa.getHeight(), pool,
+            [&](int face, Vec3f* screenCoords, const Eigen::Matrix3f* weights, auto& local, int x0, int y0, int x1, int y1, int worker) {
+                shadeTriangleMSAA(screenCoords, local, msaa, x0, y0, x1, y1, weights);
+            }, nullptr, 0.5f);
+    });
+}
+
+void drawModelVisibility(Model* model, int draw, Shader& shader, VisibilityBuffer& vbuffer, ZBuffer& zbuffer, ThreadPool& pool) {
+    std::vector<long long> fragments(pool.size(), 0);
+    dispatchShader(shader, [&](auto& s) {
+        drawTiles(model, s, vbuffer.getWidth(), vbuffer.getHeight(), pool,
+            [&](int face, Vec3f* screenCoords, const Eigen::Matrix3f* weights, auto& local, int x0, int y0, int x1, int y1, int worker) {
+                auto store = [&](int x, int y, const Vec3f& bc) {
+                    vbuffer.set(x, y, draw, face, bc);
+                    fragments[worker]++;
+                };
+                rasterize(screenCoords, zbuffer, x0, y0, x1, y1, store, weights);
+            });
+    });
+    for (long long n : fragments) vbuffer.addFragments(n);
+}
+
+long long shadeVisibility(std::vector<Model*>& models, std::vector<Shader*>& shaders, VisibilityBuffer& vbuffer, Framebuffer& framebuffer, ThreadPool& pool) {
+    StageTimer timer(STAGE_SHADE);
+    int width = vbuffer.getWidth();
+    std::vector<long long> shaded(pool.size(), 0);
+    //One pass per draw so the shader type is resolved once per draw rather than per pixel
+    for (int draw = 0; draw < (int)shaders.size(); draw++) {
+        Model* model = models[draw];
+        dispatchShader(*shaders[draw], [&](auto& s) {
+            typedef typename std::remove_reference<decltype(s)>::type S;
+            std::vector<std::unique_ptr<S> > locals(pool.size());
+            pool.parallelFor(vbuffer.getHeight(), [&](int y, int worker) {
+                int lastFace = -1;
+                long long rowShaded = 0, rowDiscarded = 0;
+                for (int x = 0; x < width; x++) {
+                    VisibilityBuffer::Sample& sample = vbuffer.get(x, y);
+                    if (sample.draw != draw) continue;
+                    if (!locals[worker]) locals[worker].reset(cloneShader(s));
+                    S& shader = *locals[worker];
+                    //Neighbouring pixels mostly belong to the same face, only reload the face when it changes
+                    if (sample.face != lastFace) {
+                        Vec3f screenCoords[3];
+                        assembleFace(model, sample.face, shader, nullptr, screenCoords);
+                        lastFace = sample.face;
+                    }
+                    TGAColor color;
+                    bool discard = shader.fragment(sample.bc, color);
+                    framebuffer.set(x, y, discard ? Framebuffer::pack(TGAColor(0, 0, 0)) : Framebuffer::pack(color));
+                    rowShaded++;
+                    rowDiscarded += discard;
+                }
+                shaded[worker] += rowShaded;
+                if (collectStats && rowShaded) {
+                    RenderCounters& counters = threadStats();
+                    counters.fragmentsShaded += rowShaded;
+                    counters.fragmentsDiscarded += rowDiscarded;
+                    counters.textureSamples += locals[worker]->takeTextureSamples();
+                }
+            });
+        });
+    }
+    long long total = 0;
+    for (long long n : shaded) total += n;
+    return total;
+}
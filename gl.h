@@ -1,17 +1,54 @@
 #pragma once
 
+#include <memory>
+#include <vector>
 #include <Eigen/Dense>
 #include "tgaimage.h"
+#include "framebuffer.h"
 #include "shader.h"
+#include "model.h"
+#include "threadpool.h"
+#include "zbuffer.h"
+#include "visibility.h"
+#include "vertexcache.h"
+#include "multisample.h"
+#include "renderstats.h"
 
 typedef Eigen::Matrix4f Matrix;
 typedef Eigen::Vector3f Vec3f;
 typedef Eigen::Vector2f Vec2f;
 
+const int TILE_SIZE = 64;
+//Pixel block size of the edge function rasterizer, TILE_SIZE must be a multiple of it
+const int RASTER_BLOCK = ZBUFFER_BLOCK;
+//Screen positions are snapped to 1 / (1 << SUBPIXEL_BITS) of a pixel before rasterization; 4 bits keep the
+//per-pixel edge steps of a guard band sized triangle in 32 bits
+const int SUBPIXEL_BITS = 4;
+
 Matrix getViewport(int w, int h);
 Matrix getProjection(Vec3f camera, Vec3f center);
 Matrix getView(Vec3f camera, Vec3f center, Vec3f up);
 void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color);
 void lineBresenham(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color);
 Vec3f barycentric(Vec3f A, Vec3f B, Vec3f C, Vec3f P);
-void triangleBoundingBox(Vec3f* verts, Shader& shader, TGAImage& image, float* zbuffer);
\ No newline at end of file
+void triangleBoundingBox(Vec3f* verts, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer);
+//Only rasterizes the pixels inside [x0, x1) x [y0, y1)
+void triangleBoundingBox(Vec3f* verts, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, int x0, int y0, int x1, int y1);
+void drawModel(Model* model, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer);
+//Bins the faces into TILE_SIZE tiles and rasterizes the tiles on the pool, same output as drawModel
+void drawModelTiled(Model* model, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, ThreadPool& pool);
+//Depth-only pass for shadow maps: no attributes, no fragment shader, only the depth test and write
+void drawDepth(Model* model, const Matrix& mvp, ZBuffer& zbuffer, ThreadPool& pool);
+//Z-prepass mode: drawModelDepth() writes only depth, once every model is in, drawModelEqual() shades just the
+//pixels whose depth equals the stored one so each runs the fragment shader once. Both passes read the vertices
+//from the same cache, filled by drawModelDepth(), so they are transformed once
+void drawModelDepth(Model* model, Shader& shader, ZBuffer& zbuffer, VertexCache& cache, ThreadPool& pool);
+void drawModelEqual(Model* model, Shader& shader, Framebuffer& framebuffer, ZBuffer& zbuffer, VertexCache& cache, ThreadPool& pool);
+//Renders one view per shader into framebuffers[i], views run concurrently and share the mesh and textures
+void drawModelViews(Model* model, std::vector<Shader*>& shaders, std::vector<std::unique_ptr<Framebuffer> >& framebuffers, ThreadPool& pool);
+//Multisampled draw: coverage and depth per sample, one fragment per pixel and triangle; resolve the buffer when done
+void drawModelMSAA(Model* model, Shader& shader, MultisampleBuffer& msaa, ThreadPool& pool);
+//Deferred mode: only writes draw/face/barycentrics of the visible surface, shadeVisibility() shades it later
+void drawModelVisibility(Model* model, int draw, Shader& shader, VisibilityBuffer& vbuffer, ZBuffer& zbuffer, ThreadPool& pool);
+//Shades every covered pixel exactly once with shaders[draw], returns the number of shaded pixels
+long long shadeVisibility(std::vector<Model*>& models, std::vector<Shader*>& shaders, VisibilityBuffer& vbuffer, Framebuffer& framebuffer, ThreadPool& pool);
\ No newline at end of file
@@ -1,64 +1,278 @@
 #include "tgaimage.h"
 #include "model.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "gl.h"
 #include "shader.h"
+#include "renderserver.h"
+#include "aobaker.h"
+#include "framestream.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
 const TGAColor green = TGAColor(0, 255, 0, 255);
 const int width = 2000;
 const int height = 2000;
+const int shadowSize = 2048;
 Model* model = nullptr;
 Vec3f lightDir(0.3, -0.7, -1);
 Vec3f camera(0.25, 0.3, 2);
 Vec3f center(0, 0, 0);
 Vec3f viewDir = center - camera;
 float ambient = 0.1f;
+const float PI = 3.14159265f;
+
+//Value of an integer flag such as -views n; prints a usage error unless it is a whole number >= minimum
+static bool parseFlagInt(const char* flag, const char* value, int minimum, int& result) {
+    char* end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (end == value || *end || errno || v < minimum || v > INT_MAX) {
+        std::cerr << flag << " expects a whole number >= " << minimum << ", got \"" << value << "\"" << std::endl;
+        return false;
+    }
+    result = (int)v;
+    return true;
+}
 
 int main(int argc, char** argv) {
-    TGAImage image(width, height, TGAImage::RGB);
-    Matrix shadowMVP;
-    float* zbuffer = new float[width * height];
-    for (int i = 0; i < width * height; i++) {
-        zbuffer[i] = -std::numeric_limits<float>::max();
+    //-deferred: rasterize every model into a visibility buffer first and shade each pixel once at the end
+    bool deferred = false;
+    //-server: read one job per line from stdin (see RenderJob), -socket path: the same over a local socket
+    bool server = false;
+    std::string socketPath;
+    //-prepass: depth of every model first, then shade only the pixels whose depth matches
+    bool prepass = false;
+    //-ao: bake (or load the cached) per-vertex ambient occlusion of every model
+    bool occlusion = false;
+    //-shadows: shadow map from lightDir, -pcf: filter its lookups over 3x3 texels
+    bool shadows = false;
+    bool pcf = false;
+    //-views n: turntable of n cameras around the first model, rendered concurrently into output_<i>.tga
+    int views = 0;
+    //-msaa 4|8: multisampled forward rendering, resolved into output.tga
+    int msaaSamples = 0;
+    //-stream rgb|rgba|ppm|tga: write the -views frames back to back to stdout (or -fd n) instead of files
+    bool stream = false;
+    FrameFormat streamFormat = FRAME_RGB;
+    int streamFd = 1;
+    TextureFilter filter = FILTER_NEAREST;
+    for (int i = 1; i < argc; i++) {
+        //-stats: pipeline counters and stage times per model (per job in server mode) on stderr, -stats-json as JSON lines
+        if (std::string(argv[i]) == "-stats") collectStats = true;
+        if (std::string(argv[i]) == "-stats-json") collectStats = statsJson = true;
+        if (std::string(argv[i]) == "-deferred") deferred = true;
+        if (std::string(argv[i]) == "-server") server = true;
+        if (std::string(argv[i]) == "-socket" && i + 1 < argc) socketPath = argv[++i];
+        if (std::string(argv[i]) == "-views" && i + 1 < argc && !parseFlagInt("-views", argv[++i], 1, views)) return 1;
+        if (std::string(argv[i]) == "-msaa" && i + 1 < argc && !parseFlagInt("-msaa", argv[++i], 0, msaaSamples)) return 1;
+        if (std::string(argv[i]) == "-stream" && i + 1 < argc) {
+            stream = FrameStream::parseFormat(argv[++i], streamFormat);
+            if (!stream) {
+                std::cerr << "unknown stream format " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        if (std::string(argv[i]) == "-fd" && i + 1 < argc && !parseFlagInt("-fd", argv[++i], 0, streamFd)) return 1;
+        if (std::string(argv[i]) == "-shadows") shadows = true;
+        if (std::string(argv[i]) == "-prepass") prepass = true;
+        if (std::string(argv[i]) == "-ao") occlusion = true;
+        if (std::string(argv[i]) == "-pcf") shadows = pcf = true;
+        //-filter nearest|bilinear|trilinear: texture sampling, trilinear picks the mip level per triangle
+        if (std::string(argv[i]) == "-filter" && i + 1 < argc && !parseTextureFilter(argv[++i], filter)) {
+            std::cerr << "unknown texture filter " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    //Only the forward path into output.tga draws multisampled
+    if (msaaSamples && !MultisampleBuffer::isSupported(msaaSamples)) {
+        std::cerr << "-msaa supports 4 or 8 samples, got " << msaaSamples << std::endl;
+        return 1;
+    }
+    if (msaaSamples && (deferred || prepass || views > 0 || server || !socketPath.empty())) {
+        std::cerr << "-msaa can't be combined with -deferred, -prepass, -views, -server or -socket" << std::endl;
+        return 1;
+    }
+    if (stream && views == 0) {
+        std::cerr << "-stream needs -views n" << std::endl;
+        return 1;
+    }
+    if (server || !socketPath.empty()) {
+        ThreadPool pool;
+        RenderServer renderServer(pool);
+        if (!socketPath.empty()) return renderServer.serveSocket(socketPath) ? 0 : 1;
+        renderServer.serve(std::cin, std::cout);
+        return 0;
+    }
+    if (views > 0) {
+        std::string path;
+        if (!(std::cin >> path)) return 1;
+        ThreadPool pool;
+        Model turntable(path, true, &pool);
+        if (!turntable.isActive()) return 1;
+        std::vector<Shader*> viewShaders;
+        Vec3f offset = camera - center;
+        float radius = std::sqrt(offset.x() * offset.x() + offset.z() * offset.z());
+        for (int v = 0; v < views; v++) {
+            float angle = std::atan2(offset.x(), offset.z()) + 2.0f * PI * v / views;
+            Vec3f eye = center + Vec3f(radius * std::sin(angle), offset.y(), radius * std::cos(angle));
+            viewShaders.push_back(new BlinnPhongShader(getViewport(width, height), getProjection(eye, center),
+                getView(eye, center, Vec3f(0, 1.0f, 0)), lightDir, turntable.getTexture(), ambient, center - eye,
+                turntable.getSpecular(), 64.0f, turntable.getNormal()));
+            viewShaders.back()->setFilter(filter);
+        }
+        if (stream) {
+            //Frames are rendered one at a time with every thread, each is written while the next renders.
+            //A reader that closes the pipe early turns into a failed write instead of killing the process
+#ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+#endif
+            FrameStream frames(streamFd, streamFormat, width, height);
+            ZBuffer zbuffer(width, height);
+            bool ok = true;
+            auto start = std::chrono::steady_clock::now();
+            for (int v = 0; v < views && ok; v++) {
+                Framebuffer& frame = frames.frame();
+                frame.clear();
+                zbuffer.clear();
+                drawModelTiled(&turntable, *viewShaders[v], frame, zbuffer, pool);
+                ok = frames.submit();
+            }
+            ok = frames.flush() && ok;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << "stream: " << views << " frames in " << elapsed.count() * 1000.0 << " ms, "
+                << views / elapsed.count() << " frames/s" << std::endl;
+            if (!ok) std::cerr << "stream: write failed: " << strerror(frames.getError()) << std::endl;
+            if (collectStats) reportStats(path, renderStatsSnapshot());
+            for (Shader* shader : viewShaders) delete shader;
+            return ok ? 0 : 1;
+        }
+        std::vector<std::unique_ptr<Framebuffer> > framebuffers;
+        for (int v = 0; v < views; v++) framebuffers.emplace_back(new Framebuffer(width, height));
+        auto start = std::chrono::steady_clock::now();
+        drawModelViews(&turntable, viewShaders, framebuffers, pool);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "views: " << views << " in " << elapsed.count() * 1000.0 << " ms, " << views / elapsed.count()
+            << " views/s" << std::endl;
+        TGAImage output(width, height, TGAImage::RGB);
+        for (int v = 0; v < views; v++) {
+            char name[32];
+            snprintf(name, sizeof(name), "output_%03d.tga", v);
+            framebuffers[v]->toImage(output);
+            output.write_tga_file(name);
+            delete viewShaders[v];
+        }
+        //Views render concurrently, so stage times are summed over the threads
+        if (collectStats) reportStats(path, renderStatsSnapshot());
+        return 0;
     }
+    Framebuffer framebuffer(width, height);
+    ZBuffer zbuffer(width, height);
+    ThreadPool pool;
+    std::unique_ptr<VisibilityBuffer> vbuffer(deferred ? new VisibilityBuffer(width, height) : nullptr);
+    std::unique_ptr<MultisampleBuffer> msaa(msaaSamples > 0 ? new MultisampleBuffer(width, height, msaaSamples) : nullptr);
+    std::vector<Model*> models;
+    std::vector<std::string> modelPaths;
+    std::vector<Shader*> shaders;
+    std::vector<std::unique_ptr<VertexCache> > caches;
     std::string s;
     //obj/african_head/african_head.obj
     //obj/african_head/african_head_eye_inner.obj
     while(std::cin >> s){
-        model = new Model(s);
-        if (!model->isActive()) break;
+        model = new Model(s, true, &pool);
+        if (!model->isActive()) {
+            delete model;
+            break;
+        }
+        if (occlusion) loadAO(model, s, pool);
+        models.push_back(model);
+        modelPaths.push_back(s);
+    }
+    //Every model has to be in the shadow map before the first one is shaded
+    std::unique_ptr<ShadowMap> shadowMap;
+    if (shadows && !models.empty()) {
+        float radius = 0.0f;
+        //Farthest bounding box corner from center, so the map covers every model
+        for (Model* m : models) {
+            Vec3f lo = m->getBBoxMin(), hi = m->getBBoxMax();
+            for (int corner = 0; corner < 8; corner++) {
+                Vec3f p(corner & 1 ? hi.x() : lo.x(), corner & 2 ? hi.y() : lo.y(), corner & 4 ? hi.z() : lo.z());
+                radius = std::max(radius, (p - center).norm());
+            }
+        }
+        shadowMap.reset(new ShadowMap(shadowSize, lightDir, center, radius));
+        shadowMap->setPCF(pcf);
+        for (Model* m : models) shadowMap->render(m, pool);
+    }
+    for (int draw = 0; draw < (int)models.size(); draw++) {
+        model = models[draw];
+        RenderCounters before = collectStats ? renderStatsSnapshot() : RenderCounters();
         Matrix viewport = getViewport(width, height);
         Matrix projection = getProjection(camera, center);
         Matrix view = getView(camera, center, Vec3f(0, 1.0f, 0));
 
-        TGAImage texture = model->getTexture();
-        TGAImage specularMap = model->getSpecular();
-        TGAImage normalMap = model->getNormal();
+        Texture texture = model->getTexture();
+        Texture specularMap = model->getSpecular();
+        Texture normalMap = model->getNormal();
 
         //FlatShader shader(viewport, projection, view, lightDir, texture);
         //GouraudShader shader(viewport, projection, view, lightDir, texture);
         //ToonShader shader(viewport, projection, view, lightDir);
         //PhongShader shader(viewport, projection, view, lightDir, texture, ambient, viewDir, specularMap, 64.0f, normalMap);
         BlinnPhongShader shader(viewport, projection, view, lightDir, texture, ambient, viewDir, specularMap, 64.0f, normalMap);
-        for (int i = 0; i < model->nfaces(); i++) {
-            Vec3f screenCoords[3];
-            for (int j = 0; j < 3; j++) {
-                Vec3f v = model->vert(i, j);
-                Vec2i uv = model->uv(i, j);
-                Vec3f normal = model->normal(i, j);
-                screenCoords[j] = shader.vertex(v, uv, normal, j);
-            }
-            triangleBoundingBox(screenCoords, shader, image, zbuffer);
+        shader.setShadowMap(shadowMap.get());
+        shader.setFilter(filter);
+        if (deferred) {
+            shaders.push_back(shader.clone());
+            drawModelVisibility(model, draw, *shaders.back(), *vbuffer, zbuffer, pool);
+        }
+        else if (prepass) {
+            shaders.push_back(shader.clone());
+            caches.emplace_back(new VertexCache());
+            drawModelDepth(model, *shaders.back(), zbuffer, *caches.back(), pool);
         }
+        else if (msaa) {
+            drawModelMSAA(model, shader, *msaa, pool);
+        }
+        else {
+            drawModelTiled(model, shader, framebuffer, zbuffer, pool);
+        }
+        //Prepass and deferred shade later, in those modes shading only shows up in the total
+        if (collectStats) reportStats(modelPaths[draw], renderStatsSnapshot().since(before));
         std::cout << "Completed!" << std::endl;
     }
 
-    image.flip_vertically();
+    if (prepass) {
+        for (int draw = 0; draw < (int)models.size(); draw++) {
+            drawModelEqual(models[draw], *shaders[draw], framebuffer, zbuffer, *caches[draw], pool);
+        }
+    }
+    if (deferred) {
+        long long shaded = shadeVisibility(models, shaders, *vbuffer, framebuffer, pool);
+        std::cerr << "deferred: " << vbuffer->getFragments() << " fragments passed depth, " << shaded << " shaded, "
+            << (shaded ? (double)vbuffer->getFragments() / shaded : 0.0) << "x overdraw avoided" << std::endl;
+    }
+    StageTimer outputTimer(STAGE_OUTPUT);
+    if (msaa) msaa->resolve(framebuffer);
+
+    TGAImage image(width, height, TGAImage::RGB);
+    framebuffer.toImage(image);
     image.write_tga_file("output.tga");
+    outputTimer.stop();
+    //The total includes the shadow map and the deferred or prepass shading passes
+    if (collectStats) reportStats("total", renderStatsSnapshot());
 
-    delete model;
-    delete[] zbuffer;
+    for (Shader* shader : shaders) delete shader;
+    for (Model* m : models) delete m;
     return 0;
 }
@@ -0,0 +1,105 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <atomic>
+#include "mappedfile.h"
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data_(NULL), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(NULL) {
+}
+#else
+MappedFile::MappedFile() : data_(NULL), size_(0), fd_(-1) {
+}
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+#ifdef _WIN32
+    file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    size_ = (size_t)size.QuadPart;
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_) {
+        close();
+        return false;
+    }
+    data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size == 0) {
+        close();
+        return false;
+    }
+    size_ = (size_t)st.st_size;
+    void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    data_ = p == MAP_FAILED ? NULL : (const char*)p;
+#endif
+    if (!data_) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) munmap((void*)data_, size_);
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+#endif
+    data_ = NULL;
+    size_ = 0;
+}
+
+bool MappedFile::isOpen() {
+    return data_ != NULL;
+}
+
+const char* MappedFile::data() {
+    return data_;
+}
+
+size_t MappedFile::size() {
+    return size_;
+}
+
+std::string replaceExtension(const std::string& path, const std::string& ext) {
+    size_t name = path.find_last_of("/\\");
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || (name != std::string::npos && dot < name)) return path + ext;
+    return path.substr(0, dot) + ext;
+}
+
+std::string tempFileName(const std::string& path) {
+    static std::atomic<unsigned> counter(0);
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = (int)getpid();
+#endif
+    return path + "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+//Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const char* data_;
+    size_t size_;
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#else
+    int fd_;
+#endif
+public:
+    MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator =(const MappedFile&) = delete;
+    ~MappedFile();
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen();
+    const char* data();
+    size_t size();
+};
+
+//Path with the extension of its file name replaced by ext (".zmesh"), ext is appended when the name has none;
+//dots in directory names are not extensions
+std::string replaceExtension(const std::string& path, const std::string& ext);
+//Name next to path for writing a file before renaming it over path, unique per process and call
+//so concurrent writers of the same cache never share a temporary
+std::string tempFileName(const std::string& path);
@@ -1,56 +1,156 @@
 #include <iostream>
 #include <string>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include "model.h"
+#include "objparser.h"
+#include "threadpool.h"
 
-Model::Model(std::string filename) : verts_(), faces_(), norms_(), uv_(), diffusemap_(), normalmap_(), specularmap_() {
+//Binary mesh cache layout: header, verts, normals, uvs, indices; all arrays are 4-byte aligned
+static const char MESH_CACHE_MAGIC[8] = { 'Z', 'R', 'M', 'E', 'S', 'H', 0, 0 };
+static const unsigned int MESH_CACHE_VERSION = 2;
+static const unsigned int MESH_CACHE_ENDIAN = 0x01020304;
+
+struct MeshCacheHeader {
+    char magic[8];
+    unsigned int endian;
+    unsigned int version;
+    long long sourceSize;
+    long long sourceTime;
+    int nverts;
+    int nnorms;
+    int nuvs;
+    int nindices;
+    float bboxmin[3];
+    float bboxmax[3];
+};
+
+Model::Model(std::string filename, bool useCache, ThreadPool* pool) : verts_(), indices_(), norms_(), uv_(), diffusemap_(), normalmap_(), specularmap_() {
     active = false;
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Vec3f v;
-            for (int i = 0; i < 3; i++) iss >> v[i];
-            verts_.push_back(v);
-        }
-        else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            Vec3f n;
-            for (int i = 0; i < 3; i++) iss >> n[i];
-            norms_.push_back(n);
-        }
-        else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            Vec2f uv;
-            for (int i = 0; i < 2; i++) iss >> uv[i];
-            uv_.push_back(uv);
-        }
-        else if (!line.compare(0, 2, "f ")) {
-            std::vector<Vec3i> f;
-            Vec3i tmp;
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
-                for (int i = 0; i < 3; i++) tmp[i]--; 
-                f.push_back(tmp);
-            }
-            faces_.push_back(f);
-        }
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return;
+    std::string cachefile = replaceExtension(filename, ".zmesh");
+    if (!useCache || !load_cache(cachefile, (long long)st.st_size, (long long)st.st_mtime)) {
+        if (!parse_obj(filename, pool)) return;
+        if (useCache) write_cache(cachefile, (long long)st.st_size, (long long)st.st_mtime);
     }
-    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
-    load_texture(filename, "_nm_tangent.tga", normalmap_);
-    load_texture(filename, "_spec.tga", specularmap_);
+    std::cerr << "# v# " << nverts() << " f# " << nfaces() << " vt# " << uvSpan_.size << " vn# " << normsSpan_.size << std::endl;
+    diffusemap_ = load_texture(filename, "_diffuse.tga");
+    normalmap_ = load_texture(filename, "_nm_tangent.tga");
+    specularmap_ = load_texture(filename, "_spec.tga");
     active = true;
 }
 
+bool Model::parse_obj(std::string filename, ThreadPool* pool) {
+    MappedFile file;
+    if (!file.open(filename)) return false;
+    ObjData obj;
+    ThreadPool serial(1);
+    if (!parseObj(file.data(), file.size(), obj, pool ? *pool : serial)) {
+        std::cerr << "bad face index in " << filename << std::endl;
+        return false;
+    }
+    verts_.swap(obj.verts);
+    norms_.swap(obj.norms);
+    uv_.swap(obj.uvs);
+    indices_.swap(obj.indices);
+    for (Vec3f& n : norms_) n.normalize();
+    vertsSpan_ = Span<Vec3f>{ verts_.data(), (int)verts_.size() };
+    indicesSpan_ = Span<int>{ indices_.data(), (int)indices_.size() };
+    normsSpan_ = Span<Vec3f>{ norms_.data(), (int)norms_.size() };
+    uvSpan_ = Span<Vec2f>{ uv_.data(), (int)uv_.size() };
+    bboxmin_ = Vec3f(0, 0, 0);
+    bboxmax_ = Vec3f(0, 0, 0);
+    for (int i = 0; i < (int)verts_.size(); i++) {
+        bboxmin_ = i ? Vec3f(bboxmin_.cwiseMin(verts_[i])) : verts_[i];
+        bboxmax_ = i ? Vec3f(bboxmax_.cwiseMax(verts_[i])) : verts_[i];
+    }
+    return true;
+}
+
+//Maps the cache and points the spans straight into it, nothing is parsed or copied
+bool Model::load_cache(std::string cachefile, long long sourceSize, long long sourceTime) {
+    if (!cache_.open(cachefile)) return false;
+    const MeshCacheHeader* header = (const MeshCacheHeader*)cache_.data();
+    bool valid = cache_.size() >= sizeof(MeshCacheHeader)
+        && !memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC))
+        && header->endian == MESH_CACHE_ENDIAN
+        && header->version == MESH_CACHE_VERSION
+        && header->sourceSize == sourceSize
+        && header->sourceTime == sourceTime
+        && header->nverts >= 0 && header->nnorms >= 0 && header->nuvs >= 0 && header->nindices >= 0
+        && header->nindices % 9 == 0
+        && cache_.size() == sizeof(MeshCacheHeader) + sizeof(Vec3f) * ((size_t)header->nverts + (size_t)header->nnorms)
+            + sizeof(Vec2f) * (size_t)header->nuvs + sizeof(int) * (size_t)header->nindices;
+    const char* p = cache_.data() + sizeof(MeshCacheHeader);
+    const int* indices = nullptr;
+    //Same rule as parseObj: every corner has a position, uvs and normals may be missing (-1)
+    if (valid) {
+        indices = (const int*)(p + sizeof(Vec3f) * ((size_t)header->nverts + (size_t)header->nnorms)
+            + sizeof(Vec2f) * (size_t)header->nuvs);
+        int counts[3] = { header->nverts, header->nuvs, header->nnorms };
+        for (int i = 0; i < header->nindices && valid; i++) {
+            int lowest = i % 3 == 0 ? 0 : -1;
+            valid = indices[i] >= lowest && indices[i] < counts[i % 3];
+        }
+    }
+    if (!valid) {
+        cache_.close();
+        return false;
+    }
+    vertsSpan_ = Span<Vec3f>{ (const Vec3f*)p, header->nverts };
+    p += sizeof(Vec3f) * header->nverts;
+    normsSpan_ = Span<Vec3f>{ (const Vec3f*)p, header->nnorms };
+    p += sizeof(Vec3f) * header->nnorms;
+    uvSpan_ = Span<Vec2f>{ (const Vec2f*)p, header->nuvs };
+    p += sizeof(Vec2f) * header->nuvs;
+    indicesSpan_ = Span<int>{ indices, header->nindices };
+    bboxmin_ = Vec3f(header->bboxmin[0], header->bboxmin[1], header->bboxmin[2]);
+    bboxmax_ = Vec3f(header->bboxmax[0], header->bboxmax[1], header->bboxmax[2]);
+    std::cerr << "mesh cache " << cachefile << " loaded" << std::endl;
+    return true;
+}
+
+void Model::write_cache(std::string cachefile, long long sourceSize, long long sourceTime) {
+    MeshCacheHeader header;
+    memset((void*)&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    header.endian = MESH_CACHE_ENDIAN;
+    header.version = MESH_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.nverts = (int)verts_.size();
+    header.nnorms = (int)norms_.size();
+    header.nuvs = (int)uv_.size();
+    header.nindices = (int)indices_.size();
+    for (int i = 0; i < 3; i++) {
+        header.bboxmin[i] = bboxmin_[i];
+        header.bboxmax[i] = bboxmax_[i];
+    }
+    //Written under a temporary name so a reader never maps a half written cache
+    std::string tmpfile = tempFileName(cachefile);
+    std::ofstream out;
+    out.open(tmpfile, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't write mesh cache " << cachefile << "\n";
+        return;
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)verts_.data(), sizeof(Vec3f) * verts_.size());
+    out.write((const char*)norms_.data(), sizeof(Vec3f) * norms_.size());
+    out.write((const char*)uv_.data(), sizeof(Vec2f) * uv_.size());
+    out.write((const char*)indices_.data(), sizeof(int) * indices_.size());
+    bool good = out.good();
+    out.close();
+    std::remove(cachefile.c_str());
+    if (!good || std::rename(tmpfile.c_str(), cachefile.c_str()) != 0) {
+        std::remove(tmpfile.c_str());
+        std::cerr << "can't write mesh cache " << cachefile << "\n";
+    }
+}
 
 Model::~Model() {
 }
@@ -60,45 +160,93 @@ bool Model::isActive() {
 }
 
 int Model::nverts() {
-    return (int)verts_.size();
+    return vertsSpan_.size;
 }
 
 int Model::nfaces() {
-    return (int)faces_.size();
+    return indicesSpan_.size / 9;
+}
+
+Vec3f Model::vert(int i) {
+    return vertsSpan_[i];
 }
 
 Vec3f Model::vert(int idxface, int idxvert) {
-    return verts_[faces_[idxface][idxvert][0]];
+    return vertsSpan_[indicesSpan_[idxface * 9 + idxvert * 3]];
 }
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
+int Model::vertIndex(int idxface, int idxvert) {
+    return indicesSpan_[idxface * 9 + idxvert * 3];
+}
+
+Span<Vec3f> Model::verts() {
+    return vertsSpan_;
+}
+
+Span<Vec3f> Model::normals() {
+    return normsSpan_;
+}
+
+Span<Vec2f> Model::uvs() {
+    return uvSpan_;
+}
+
+Span<int> Model::indices() {
+    return indicesSpan_;
+}
+
+Vec3f Model::getBBoxMin() {
+    return bboxmin_;
+}
+
+Vec3f Model::getBBoxMax() {
+    return bboxmax_;
+}
+
+Texture Model::load_texture(std::string filename, const char* suffix) {
     std::string texfile(filename);
     size_t dot = texfile.find_last_of(".");
     if (dot != std::string::npos) {
         texfile = texfile.substr(0, dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
     }
+    return TextureCache::load(texfile);
 }
 
-TGAImage Model::getTexture() {
+Texture Model::getTexture() {
     return diffusemap_;
 }
 
-TGAImage Model::getSpecular() {
+Texture Model::getSpecular() {
     return specularmap_;
 }
 
-TGAImage Model::getNormal() {
+Texture Model::getNormal() {
     return normalmap_;
 }
 
 Vec2i Model::uv(int idxface, int idxvert) {
-    int idx = faces_[idxface][idxvert][1];
-    return Vec2i(uv_[idx].x() * diffusemap_.get_width(), uv_[idx].y() * diffusemap_.get_height());
+    int idx = indicesSpan_[idxface * 9 + idxvert * 3 + 1];
+    if (idx < 0) return Vec2i(0, 0);
+    return Vec2i(uvSpan_[idx].x() * diffusemap_->getWidth(), uvSpan_[idx].y() * diffusemap_->getHeight());
 }
 
 Vec3f Model::normal(int idxface, int idxvert) {
-    int idx = faces_[idxface][idxvert][2];
-    return norms_[idx].normalized();
-}
\ No newline at end of file
+    int idx = indicesSpan_[idxface * 9 + idxvert * 3 + 2];
+    if (idx >= 0) return normsSpan_[idx];
+    //Faces without normals use the face normal
+    Vec3f n = (vert(idxface, 1) - vert(idxface, 0)).cross(vert(idxface, 2) - vert(idxface, 0));
+    return n.normalized();
+}
+
+bool Model::hasAO() {
+    return !ao_.empty();
+}
+
+float Model::ao(int idxface, int idxvert) {
+    if (ao_.empty()) return 1.0f;
+    return ao_[indicesSpan_[idxface * 9 + idxvert * 3]];
+}
+
+void Model::setAO(std::vector<float> ao) {
+    if (ao.empty() || (int)ao.size() == nverts()) ao_.swap(ao);
+}
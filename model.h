@@ -1,38 +1,84 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
+#include <string>
 #include <vector>
 #include <Eigen/Dense>
 #include "tgaimage.h"
+#include "mappedfile.h"
+#include "texture.h"
+
+class ThreadPool;
 
 typedef Eigen::Vector3f Vec3f;
 typedef Eigen::Vector2i Vec2i;
 typedef Eigen::Vector2f Vec2f;
 typedef Eigen::Vector3i Vec3i;
 
+//Read-only view of a contiguous array owned by a Model
+template<class T>
+struct Span {
+	const T* data;
+	int size;
+	const T& operator[](int i) const { return data[i]; }
+	const T* begin() const { return data; }
+	const T* end() const { return data + size; }
+};
+
 class Model {
 private:
+	//Owned storage when the mesh was parsed from the .obj, empty when it comes from the cache
 	std::vector<Vec3f> verts_;
-	std::vector<std::vector<Vec3i> > faces_;
+	//Triangles only, 3 corners per face and 3 indices (vert, uv, normal) per corner
+	std::vector<int> indices_;
 	std::vector<Vec3f> norms_;
 	std::vector<Vec2f> uv_;
-	TGAImage diffusemap_;
-	TGAImage normalmap_;
-	TGAImage specularmap_;
+	//Mapped .zmesh cache, the spans below point either into it or into the vectors above
+	MappedFile cache_;
+	Span<Vec3f> vertsSpan_;
+	Span<int> indicesSpan_;
+	Span<Vec3f> normsSpan_;
+	Span<Vec2f> uvSpan_;
+	Vec3f bboxmin_;
+	Vec3f bboxmax_;
+	Texture diffusemap_;
+	Texture normalmap_;
+	Texture specularmap_;
+	//Baked ambient occlusion per vertex, empty when none was attached
+	std::vector<float> ao_;
 	bool active;
-	void load_texture(std::string filename, const char* suffix, TGAImage& img);
+	Texture load_texture(std::string filename, const char* suffix);
+	bool parse_obj(std::string filename, ThreadPool* pool);
+	bool load_cache(std::string cachefile, long long sourceSize, long long sourceTime);
+	void write_cache(std::string cachefile, long long sourceSize, long long sourceTime);
 public:
-	Model(std::string filename);
+	//useCache reads/writes a binary .zmesh next to the .obj, keyed on the .obj size and mtime;
+	//a large .obj is parsed on pool, on the calling thread without one
+	Model(std::string filename, bool useCache = true, ThreadPool* pool = nullptr);
+	Model(const Model&) = delete;
+	Model& operator =(const Model&) = delete;
 	~Model();
 	bool isActive();
 	int nverts();
 	int nfaces();
+	Vec3f vert(int i);
 	Vec3f vert(int idxface, int idxvert);
+	int vertIndex(int idxface, int idxvert);
+	Span<Vec3f> verts();
+	Span<Vec3f> normals();
+	Span<Vec2f> uvs();
+	Span<int> indices();
+	Vec3f getBBoxMin();
+	Vec3f getBBoxMax();
 	Vec2i uv(int idxface, int idxvert);
 	Vec3f normal(int idxface, int idxvert);
-	TGAImage getTexture();
-	TGAImage getSpecular();
-	TGAImage getNormal();
+	Texture getTexture();
+	Texture getSpecular();
+	Texture getNormal();
+	bool hasAO();
+	//Fraction of the sky the corner sees, 1 when no occlusion was baked
+	float ao(int idxface, int idxvert);
+	void setAO(std::vector<float> ao);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <limits>
+#include <string.h>
+#include "multisample.h"
+#include "framebuffer.h"
+
+//Standard rotated 4x and 8x sample patterns, in 1/16 pixel
+static const float SAMPLES_4X[8] = {
+    -2 / 16.0f, -6 / 16.0f, 6 / 16.0f, -2 / 16.0f, -6 / 16.0f, 2 / 16.0f, 2 / 16.0f, 6 / 16.0f
+};
+static const float SAMPLES_8X[16] = {
+    1 / 16.0f, -3 / 16.0f, -1 / 16.0f, 3 / 16.0f, 5 / 16.0f, 1 / 16.0f, -3 / 16.0f, -5 / 16.0f,
+    -5 / 16.0f, 5 / 16.0f, -7 / 16.0f, -1 / 16.0f, 3 / 16.0f, 7 / 16.0f, 7 / 16.0f, -7 / 16.0f
+};
+
+bool MultisampleBuffer::isSupported(int samples) {
+    return samples == 4 || samples == 8;
+}
+
+MultisampleBuffer::MultisampleBuffer(int w, int h, int samples) : width(w), height(h), samples(samples) {
+    offsets = samples == 8 ? SAMPLES_8X : SAMPLES_4X;
+    depth = new float[width * height * this->samples];
+    color = new unsigned int[width * height * this->samples];
+    clear();
+}
+
+MultisampleBuffer::~MultisampleBuffer() {
+    delete[] depth;
+    delete[] color;
+}
+
+int MultisampleBuffer::getWidth() {
+    return width;
+}
+
+int MultisampleBuffer::getHeight() {
+    return height;
+}
+
+int MultisampleBuffer::getSamples() {
+    return samples;
+}
+
+const float* MultisampleBuffer::getOffsets() {
+    return offsets;
+}
+
+float* MultisampleBuffer::depthAt(int x, int y) {
+    return depth + (x + y * width) * samples;
+}
+
+unsigned int* MultisampleBuffer::colorAt(int x, int y) {
+    return color + (x + y * width) * samples;
+}
+
+void MultisampleBuffer::clear() {
+    std::fill(depth, depth + width * height * samples, -std::numeric_limits<float>::max());
+    std::fill(color, color + width * height * samples, 0xff000000u);
+}
+
+void MultisampleBuffer::resolve(Framebuffer& framebuffer) {
+    int w = std::min(width, framebuffer.getWidth()), h = std::min(height, framebuffer.getHeight());
+    for (int y = 0; y < h; y++) {
+        unsigned int* out = framebuffer.row(y);
+        for (int x = 0; x < w; x++) {
+            const unsigned int* c = colorAt(x, y);
+            unsigned int resolved = 0;
+            for (int i = 0; i < 4; i++) {
+                int sum = 0;
+                for (int s = 0; s < samples; s++) sum += (c[s] >> (i * 8)) & 0xff;
+                resolved |= (unsigned int)((sum + samples / 2) / samples) << (i * 8);
+            }
+            out[x] = resolved;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+class Framebuffer;
+
+//Per-sample depth and color for MSAA, samples of a pixel are stored next to each other
+class MultisampleBuffer {
+private:
+    float* depth;
+    unsigned int* color;
+    int width;
+    int height;
+    int samples;
+    const float* offsets;
+public:
+    //Sample counts with a pattern, 4 and 8
+    static bool isSupported(int samples);
+    //samples has to be supported, see isSupported
+    MultisampleBuffer(int w, int h, int samples);
+    MultisampleBuffer(const MultisampleBuffer&) = delete;
+    MultisampleBuffer& operator =(const MultisampleBuffer&) = delete;
+    ~MultisampleBuffer();
+    int getWidth();
+    int getHeight();
+    int getSamples();
+    //Offset of sample s from the pixel position in x, y pairs, inside (-0.5, 0.5)
+    const float* getOffsets();
+    float* depthAt(int x, int y);
+    //Packed bgra of each sample
+    unsigned int* colorAt(int x, int y);
+    void clear();
+    //Averages the samples of every pixel into framebuffer
+    void resolve(Framebuffer& framebuffer);
+};
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <charconv>
+#include <string.h>
+#include "objparser.h"
+#include "threadpool.h"
+
+static const size_t OBJ_CHUNK_MIN_BYTES = 4 << 20;
+
+struct ObjChunk {
+    ObjData obj;
+    //Positions in obj.indices that came from negative indices and still need the counts of the previous chunks
+    std::vector<int> relative;
+};
+
+static const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static const char* parseFloat(const char* p, const char* end, float& v) {
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+') p++;
+    std::from_chars_result r = std::from_chars(p, end, v);
+    if (r.ec != std::errc()) {
+        v = 0.0f;
+        return p;
+    }
+    return r.ptr;
+}
+
+static const char* parseInt(const char* p, const char* end, int& v, bool& found) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    found = false;
+    v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        found = true;
+    }
+    if (negative) v = -v;
+    return p;
+}
+
+//1-based or negative .obj index to a 0-based one, -1 when missing, -2 for the invalid index 0
+static int resolveIndex(int idx, bool found, int count, bool& relative) {
+    relative = false;
+    if (!found) return -1;
+    if (idx == 0) return -2;
+    if (idx > 0) return idx - 1;
+    relative = true;
+    return count + idx;
+}
+
+static void parseChunk(const char* p, const char* end, ObjChunk& chunk) {
+    ObjData& obj = chunk.obj;
+    std::vector<int> corners;
+    std::vector<char> relative;
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        const char* q = skipSpaces(p, eol);
+        p = eol + 1;
+        if (eol - q < 2) continue;
+        if (q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+            Vec3f v;
+            q += 1;
+            for (int i = 0; i < 3; i++) q = parseFloat(q, eol, v[i]);
+            obj.verts.push_back(v);
+        }
+        else if (q[0] == 'v' && q[1] == 'n') {
+            Vec3f n;
+            q += 2;
+            for (int i = 0; i < 3; i++) q = parseFloat(q, eol, n[i]);
+            obj.norms.push_back(n);
+        }
+        else if (q[0] == 'v' && q[1] == 't') {
+            Vec2f uv;
+            q += 2;
+            for (int i = 0; i < 2; i++) q = parseFloat(q, eol, uv[i]);
+            obj.uvs.push_back(uv);
+        }
+        else if (q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+            corners.clear();
+            relative.clear();
+            q += 1;
+            while (true) {
+                q = skipSpaces(q, eol);
+                if (q >= eol || *q == '\r' || *q == '#') break;
+                int idx[3] = { 0, 0, 0 };
+                bool found[3] = { false, false, false };
+                q = parseInt(q, eol, idx[0], found[0]);
+                if (!found[0]) break;
+                if (q < eol && *q == '/') {
+                    q = parseInt(q + 1, eol, idx[1], found[1]);
+                    if (q < eol && *q == '/') q = parseInt(q + 1, eol, idx[2], found[2]);
+                }
+                int counts[3] = { (int)obj.verts.size(), (int)obj.uvs.size(), (int)obj.norms.size() };
+                for (int i = 0; i < 3; i++) {
+                    bool rel;
+                    corners.push_back(resolveIndex(idx[i], found[i], counts[i], rel));
+                    relative.push_back(rel);
+                }
+                while (q < eol && *q != ' ' && *q != '\t' && *q != '\r') q++;
+            }
+            //Polygons are split into a triangle fan
+            int n = (int)corners.size() / 3;
+            for (int k = 1; k + 1 < n; k++) {
+                for (int c : { 0, k, k + 1 }) {
+                    for (int i = 0; i < 3; i++) {
+                        if (relative[c * 3 + i]) chunk.relative.push_back((int)obj.indices.size());
+                        obj.indices.push_back(corners[c * 3 + i]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool parseObj(const char* data, size_t size, ObjData& obj, ThreadPool& pool) {
+    int nchunks = (int)std::max<size_t>(1, std::min<size_t>(pool.size(), size / OBJ_CHUNK_MIN_BYTES));
+    std::vector<const char*> bounds(nchunks + 1);
+    bounds[0] = data;
+    bounds[nchunks] = data + size;
+    for (int i = 1; i < nchunks; i++) {
+        const char* p = std::max(bounds[i - 1], data + size / nchunks * i);
+        const char* eol = (const char*)memchr(p, '\n', data + size - p);
+        bounds[i] = eol ? eol + 1 : data + size;
+    }
+    std::vector<ObjChunk> chunks(nchunks);
+    pool.parallelFor(nchunks, [&](int i, int worker) { parseChunk(bounds[i], bounds[i + 1], chunks[i]); });
+
+    size_t nverts = 0, nnorms = 0, nuvs = 0, nindices = 0;
+    for (ObjChunk& chunk : chunks) {
+        nverts += chunk.obj.verts.size();
+        nnorms += chunk.obj.norms.size();
+        nuvs += chunk.obj.uvs.size();
+        nindices += chunk.obj.indices.size();
+    }
+    obj.verts.reserve(nverts);
+    obj.norms.reserve(nnorms);
+    obj.uvs.reserve(nuvs);
+    obj.indices.reserve(nindices);
+    for (ObjChunk& chunk : chunks) {
+        int offsets[3] = { (int)obj.verts.size(), (int)obj.uvs.size(), (int)obj.norms.size() };
+        for (int pos : chunk.relative) chunk.obj.indices[pos] += offsets[pos % 3];
+        obj.verts.insert(obj.verts.end(), chunk.obj.verts.begin(), chunk.obj.verts.end());
+        obj.norms.insert(obj.norms.end(), chunk.obj.norms.begin(), chunk.obj.norms.end());
+        obj.uvs.insert(obj.uvs.end(), chunk.obj.uvs.begin(), chunk.obj.uvs.end());
+        obj.indices.insert(obj.indices.end(), chunk.obj.indices.begin(), chunk.obj.indices.end());
+    }
+    int counts[3] = { (int)obj.verts.size(), (int)obj.uvs.size(), (int)obj.norms.size() };
+    for (size_t i = 0; i < obj.indices.size(); i++) {
+        int lowest = i % 3 == 0 ? 0 : -1;
+        if (obj.indices[i] < lowest || obj.indices[i] >= counts[i % 3]) return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <Eigen/Dense>
+
+typedef Eigen::Vector3f Vec3f;
+typedef Eigen::Vector2f Vec2f;
+
+class ThreadPool;
+
+//Raw contents of an .obj, faces fan-triangulated into 3 corners of (vert, uv, normal) indices;
+//an index is -1 when the face does not reference that attribute
+struct ObjData {
+    std::vector<Vec3f> verts;
+    std::vector<Vec3f> norms;
+    std::vector<Vec2f> uvs;
+    std::vector<int> indices;
+};
+
+//Parses an in-memory .obj (v, vt, vn and f in the v, v/vt, v//vn and v/vt/vn forms, negative
+//indices included); files larger than a few MB are split at line boundaries, one piece per pool
+//worker, parsed on the pool and merged in file order; fails on an index of 0, an
+//out-of-range index or a face corner without a position
+bool parseObj(const char* data, size_t size, ObjData& obj, ThreadPool& pool);
@@ -0,0 +1,273 @@
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <chrono>
+#include <new>
+#include <cstdio>
+#include <sstream>
+#include <string.h>
+#include "renderserver.h"
+
+//Free buffers kept for reuse, enough for a few resolutions in flight
+static const int MAX_FREE_BUFFERS = 4;
+//Largest accepted image side, keeps width * height and the buffer sizes in range
+static const int MAX_IMAGE_SIZE = 16384;
+
+#ifndef _WIN32
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//Writes the whole reply; a client that hung up fails the send instead of raising SIGPIPE
+static bool sendAll(int client, const char* p, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(client, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+#endif
+
+static bool parseVec3(const std::string& value, Vec3f& v) {
+    std::istringstream in(value);
+    char sep;
+    return (bool)(in >> v[0] >> sep >> v[1] >> sep >> v[2]);
+}
+
+static std::vector<std::string> split(const std::string& value, char sep) {
+    std::vector<std::string> parts;
+    std::istringstream in(value);
+    std::string part;
+    while (std::getline(in, part, sep)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+RenderJob::RenderJob() : shader("blinnphong"), camera(0.25, 0.3, 2), center(0, 0, 0), lightDir(0.3, -0.7, -1),
+    ambient(0.1f), filter(FILTER_NEAREST), width(2000), height(2000), output("output.tga") {
+}
+
+bool RenderJob::parse(const std::string& line, std::string& error) {
+    std::istringstream in(line);
+    std::string field;
+    while (in >> field) {
+        size_t eq = field.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value: " + field;
+            return false;
+        }
+        std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+        bool ok = true;
+        if (key == "models") models = split(value, ',');
+        else if (key == "shader") shader = value;
+        else if (key == "camera") ok = parseVec3(value, camera);
+        else if (key == "center") ok = parseVec3(value, center);
+        else if (key == "light") ok = parseVec3(value, lightDir);
+        else if (key == "ambient") ok = (bool)(std::istringstream(value) >> ambient);
+        else if (key == "filter") ok = parseTextureFilter(value, filter);
+        else if (key == "size") ok = sscanf(value.c_str(), "%dx%d", &width, &height) == 2 && width > 0 && height > 0
+            && width <= MAX_IMAGE_SIZE && height <= MAX_IMAGE_SIZE;
+        else if (key == "output") output = value;
+        else {
+            error = "unknown key " + key;
+            return false;
+        }
+        if (!ok) {
+            error = "bad value for " + key;
+            return false;
+        }
+    }
+    if (models.empty()) {
+        error = "no models";
+        return false;
+    }
+    return true;
+}
+
+//Builds the named built-in shader for one model, nullptr for an unknown name
+static Shader* createShader(const RenderJob& job, Model* model, Matrix viewport, Matrix projection, Matrix view) {
+    Vec3f viewDir = job.center - job.camera;
+    if (job.shader == "flat") return new FlatShader(viewport, projection, view, job.lightDir, model->getTexture());
+    if (job.shader == "gouraud") return new GouraudShader(viewport, projection, view, job.lightDir, model->getTexture());
+    if (job.shader == "toon") return new ToonShader(viewport, projection, view, job.lightDir);
+    if (job.shader == "phong")
+        return new PhongShader(viewport, projection, view, job.lightDir, model->getTexture(), job.ambient, viewDir,
+            model->getSpecular(), 64.0f, model->getNormal());
+    if (job.shader == "blinnphong")
+        return new BlinnPhongShader(viewport, projection, view, job.lightDir, model->getTexture(), job.ambient, viewDir,
+            model->getSpecular(), 64.0f, model->getNormal());
+    return nullptr;
+}
+
+RenderServer::RenderServer(ThreadPool& pool) : pool(pool) {
+}
+
+Model* RenderServer::getModel(const std::string& path) {
+    auto it = models.find(path);
+    if (it != models.end()) return it->second.get();
+    std::unique_ptr<Model> model(new Model(path, true, &pool));
+    //Failed loads are not kept so a file that appears later can still be rendered
+    if (!model->isActive()) return nullptr;
+    Model* m = model.get();
+    models[path] = std::move(model);
+    return m;
+}
+
+std::unique_ptr<RenderServer::RenderTarget> RenderServer::acquire(int w, int h) {
+    for (size_t i = 0; i < freeBuffers.size(); i++) {
+        if (freeBuffers[i]->framebuffer.getWidth() == w && freeBuffers[i]->framebuffer.getHeight() == h) {
+            std::unique_ptr<RenderTarget> buffer = std::move(freeBuffers[i]);
+            freeBuffers.erase(freeBuffers.begin() + i);
+            buffer->framebuffer.clear();
+            buffer->zbuffer.clear();
+            return buffer;
+        }
+    }
+    return std::unique_ptr<RenderTarget>(new RenderTarget(w, h));
+}
+
+void RenderServer::release(std::unique_ptr<RenderTarget> buffer) {
+    if ((int)freeBuffers.size() >= MAX_FREE_BUFFERS) freeBuffers.erase(freeBuffers.begin());
+    freeBuffers.push_back(std::move(buffer));
+}
+
+bool RenderServer::run(const std::string& line, std::string& reply) {
+    auto start = std::chrono::steady_clock::now();
+    RenderJob job;
+    std::string error;
+    if (!job.parse(line, error)) {
+        reply = "error " + error;
+        return false;
+    }
+    std::vector<Model*> jobModels;
+    for (const std::string& path : job.models) {
+        Model* model = getModel(path);
+        if (!model) {
+            reply = "error can't load " + path;
+            return false;
+        }
+        jobModels.push_back(model);
+    }
+    Matrix viewport = getViewport(job.width, job.height);
+    Matrix projection = getProjection(job.camera, job.center);
+    Matrix view = getView(job.camera, job.center, Vec3f(0, 1.0f, 0));
+    RenderCounters before = collectStats ? renderStatsSnapshot() : RenderCounters();
+    std::unique_ptr<RenderTarget> buffer;
+    //A large image that does not fit fails the job, not the server
+    try {
+        buffer = acquire(job.width, job.height);
+    }
+    catch (const std::bad_alloc&) {
+        freeBuffers.clear();
+        reply = "error out of memory for size " + std::to_string(job.width) + "x" + std::to_string(job.height);
+        return false;
+    }
+    for (Model* model : jobModels) {
+        std::unique_ptr<Shader> shader(createShader(job, model, viewport, projection, view));
+        if (!shader) {
+            release(std::move(buffer));
+            reply = "error unknown shader " + job.shader;
+            return false;
+        }
+        shader->setFilter(job.filter);
+        drawModelTiled(model, *shader, buffer->framebuffer, buffer->zbuffer, pool);
+    }
+    StageTimer outputTimer(STAGE_OUTPUT);
+    buffer->framebuffer.toImage(buffer->image);
+    bool written = buffer->image.write_tga_file(job.output.c_str());
+    outputTimer.stop();
+    release(std::move(buffer));
+    if (collectStats) reportStats(job.output, renderStatsSnapshot().since(before));
+    if (!written) {
+        reply = "error can't write " + job.output;
+        return false;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::ostringstream out;
+    out << "ok " << job.output << " " << elapsed.count();
+    reply = out.str();
+    return true;
+}
+
+void RenderServer::serve(std::istream& in, std::ostream& out) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        if (line == "quit") break;
+        std::string reply;
+        run(line, reply);
+        out << reply << std::endl;
+    }
+}
+
+bool RenderServer::serveSocket(const std::string& path) {
+#ifdef _WIN32
+    std::cerr << "socket server is not supported on this platform" << std::endl;
+    return false;
+#else
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "socket path too long: " << path << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) return false;
+    unlink(path.c_str());
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+        std::cerr << "can't listen on " << path << std::endl;
+        close(listener);
+        return false;
+    }
+    bool quit = false;
+    while (!quit) {
+        int client = accept(listener, NULL, NULL);
+        //Interrupted calls and clients that gave up while queued are not the listener failing
+        if (client < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+        if (client < 0) break;
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        bool connected = true;
+        std::string pending;
+        char chunk[4096];
+        ssize_t n;
+        while (!quit && connected && (n = read(client, chunk, sizeof(chunk))) > 0) {
+            pending.append(chunk, n);
+            size_t eol;
+            while ((eol = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, eol);
+                pending.erase(0, eol + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty() || line[0] == '#') continue;
+                if (line == "quit") {
+                    quit = true;
+                    break;
+                }
+                std::string reply;
+                run(line, reply);
+                reply += '\n';
+                if (!sendAll(client, reply.data(), reply.size())) {
+                    connected = false;
+                    break;
+                }
+            }
+        }
+        close(client);
+    }
+    close(listener);
+    unlink(path.c_str());
+    return true;
+#endif
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gl.h"
+
+//One render request, a line of key=value fields:
+//models=a.obj,b.obj shader=blinnphong camera=0.25,0.3,2 center=0,0,0 light=0.3,-0.7,-1 size=800x800 output=a.tga
+//filter=nearest (size is at most 16384 on either side)
+struct RenderJob {
+    std::vector<std::string> models;
+    std::string shader;
+    Vec3f camera;
+    Vec3f center;
+    Vec3f lightDir;
+    float ambient;
+    TextureFilter filter;
+    int width;
+    int height;
+    std::string output;
+
+    RenderJob();
+    //Fills the fields present in line, returns false with error set on an unknown key or bad value
+    bool parse(const std::string& line, std::string& error);
+};
+
+//Renders a stream of jobs in one process: models and their textures stay loaded between jobs and
+//image/depth buffers of the same size are recycled instead of reallocated
+class RenderServer {
+private:
+    //Render target plus the image it is converted into for writing
+    struct RenderTarget {
+        Framebuffer framebuffer;
+        ZBuffer zbuffer;
+        TGAImage image;
+        RenderTarget(int w, int h) : framebuffer(w, h), zbuffer(w, h), image(w, h, TGAImage::RGB) {}
+    };
+    ThreadPool& pool;
+    std::map<std::string, std::unique_ptr<Model> > models;
+    std::vector<std::unique_ptr<RenderTarget> > freeBuffers;
+
+    Model* getModel(const std::string& path);
+    std::unique_ptr<RenderTarget> acquire(int w, int h);
+    void release(std::unique_ptr<RenderTarget> buffer);
+public:
+    RenderServer(ThreadPool& pool);
+    //Renders one job line and writes the image, reply is "ok <output> <ms>" or "error <reason>"
+    bool run(const std::string& line, std::string& reply);
+    //Answers every line of in on out until end of input or a "quit" line
+    void serve(std::istream& in, std::ostream& out);
+    //Same protocol over a local socket, one connection at a time
+    bool serveSocket(const std::string& path);
+};
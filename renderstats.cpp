@@ -0,0 +1,100 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "renderstats.h"
+
+bool collectStats = false;
+bool statsJson = false;
+
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<RenderCounters> > registry;
+static thread_local RenderCounters* localStats = nullptr;
+
+static const char* STAGE_NAMES[STAGE_COUNT] = { "geometry", "raster", "shade", "output" };
+
+RenderCounters& threadStats() {
+    if (!localStats) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.emplace_back(new RenderCounters());
+        localStats = registry.back().get();
+    }
+    return *localStats;
+}
+
+RenderCounters renderStatsSnapshot() {
+    RenderCounters total = RenderCounters();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const std::unique_ptr<RenderCounters>& counters : registry) total.add(*counters);
+    return total;
+}
+
+void RenderCounters::add(const RenderCounters& other) {
+    facesSubmitted += other.facesSubmitted;
+    facesCulled += other.facesCulled;
+    trianglesRasterized += other.trianglesRasterized;
+    pixelsTested += other.pixelsTested;
+    depthPassed += other.depthPassed;
+    depthFailed += other.depthFailed;
+    fragmentsShaded += other.fragmentsShaded;
+    fragmentsDiscarded += other.fragmentsDiscarded;
+    textureSamples += other.textureSamples;
+    for (int i = 0; i < STAGE_COUNT; i++) stageNs[i] += other.stageNs[i];
+}
+
+RenderCounters RenderCounters::since(const RenderCounters& before) const {
+    RenderCounters delta = *this;
+    delta.facesSubmitted -= before.facesSubmitted;
+    delta.facesCulled -= before.facesCulled;
+    delta.trianglesRasterized -= before.trianglesRasterized;
+    delta.pixelsTested -= before.pixelsTested;
+    delta.depthPassed -= before.depthPassed;
+    delta.depthFailed -= before.depthFailed;
+    delta.fragmentsShaded -= before.fragmentsShaded;
+    delta.fragmentsDiscarded -= before.fragmentsDiscarded;
+    delta.textureSamples -= before.textureSamples;
+    for (int i = 0; i < STAGE_COUNT; i++) delta.stageNs[i] -= before.stageNs[i];
+    return delta;
+}
+
+void RenderCounters::print(const std::string& name, std::ostream& out) const {
+    out << "stats " << name << ": faces " << facesSubmitted << " submitted, " << facesCulled << " culled, "
+        << trianglesRasterized << " rasterized; pixels " << pixelsTested << " tested, " << depthPassed << " passed, "
+        << depthFailed << " failed; fragments " << fragmentsShaded << " shaded, " << fragmentsDiscarded
+        << " discarded; " << textureSamples << " texture samples;";
+    for (int i = 0; i < STAGE_COUNT; i++) out << " " << STAGE_NAMES[i] << " " << stageNs[i] / 1e6 << " ms";
+    out << std::endl;
+}
+
+//Quoted JSON string: quotes, backslashes and control characters escaped
+static std::string jsonString(const std::string& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            quoted += code;
+        }
+        else quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void RenderCounters::printJson(const std::string& name, std::ostream& out) const {
+    out << "{\"name\": " << jsonString(name) << ", \"faces_submitted\": " << facesSubmitted << ", \"faces_culled\": " << facesCulled
+        << ", \"triangles_rasterized\": " << trianglesRasterized << ", \"pixels_tested\": " << pixelsTested
+        << ", \"depth_passed\": " << depthPassed << ", \"depth_failed\": " << depthFailed << ", \"fragments_shaded\": "
+        << fragmentsShaded << ", \"fragments_discarded\": " << fragmentsDiscarded << ", \"texture_samples\": " << textureSamples;
+    for (int i = 0; i < STAGE_COUNT; i++) out << ", \"" << STAGE_NAMES[i] << "_ms\": " << stageNs[i] / 1e6;
+    out << "}" << std::endl;
+}
+
+void reportStats(const std::string& name, const RenderCounters& counters) {
+    if (statsJson) counters.printJson(name, std::cerr);
+    else counters.print(name, std::cerr);
+}
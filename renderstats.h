@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+//Stages with their own wall time: geometry is transform, culling, clipping and binning, raster is
+//rasterization plus forward shading, shade is the deferred shading pass, output is resolve and file writing
+enum RenderStage {
+    STAGE_GEOMETRY, STAGE_RASTER, STAGE_SHADE, STAGE_OUTPUT, STAGE_COUNT
+};
+
+struct RenderCounters {
+    long long facesSubmitted;
+    long long facesCulled;
+    //Triangles handed to the rasterizer, clipped faces count once per piece
+    long long trianglesRasterized;
+    //Pixels inside a triangle that reached the depth test
+    long long pixelsTested;
+    long long depthPassed;
+    long long depthFailed;
+    long long fragmentsShaded;
+    //fragment() calls that returned true
+    long long fragmentsDiscarded;
+    //Texture fetches made by the built-in shaders through Shader::sampleTexture()
+    long long textureSamples;
+    long long stageNs[STAGE_COUNT];
+
+    void add(const RenderCounters& other);
+    //Difference against an earlier snapshot
+    RenderCounters since(const RenderCounters& before) const;
+    void print(const std::string& name, std::ostream& out) const;
+    void printJson(const std::string& name, std::ostream& out) const;
+};
+
+//Off by default; when set every thread counts into its own RenderCounters, summed by renderStatsSnapshot()
+extern bool collectStats;
+//reportStats() writes one JSON object per line instead of text
+extern bool statsJson;
+
+//The calling thread's counters, created on first use and kept for the life of the process so counts of
+//threads that have exited are still merged
+RenderCounters& threadStats();
+//Sum over every thread, only meaningful while no render is running
+RenderCounters renderStatsSnapshot();
+//Writes counters for a model or job to stderr in the format picked by statsJson
+void reportStats(const std::string& name, const RenderCounters& counters);
+
+//Adds the wall time of its scope to a stage of the calling thread, nothing when stats are off
+class StageTimer {
+private:
+    RenderStage stage;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+public:
+    StageTimer(RenderStage stage) : stage(stage), active(collectStats) {
+        if (active) start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        stop();
+    }
+    //Ends the measurement before the scope does
+    void stop() {
+        if (active) threadStats().stageNs[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        active = false;
+    }
+};
@@ -1,19 +1,98 @@
 #pragma once
 
+#include <cmath>
 #include <Eigen/Dense>
 #include "tgaimage.h"
+#include "texture.h"
+#include "shadowmap.h"
 
 typedef Eigen::Matrix4f Matrix;
 typedef Eigen::Vector3f Vec3f;
 typedef Eigen::Vector2i Vec2i;
 
+//ƽ淽̣Զ0ֵߵĲʾƬԪֻ a + b * bc[1] + c * bc[2]
+template<class T>
+struct AttributePlane {
+    T a, b, c;
+    void set(T a0, T a1, T a2) {
+        a = a0;
+        b = a1 - a0;
+        c = a2 - a0;
+    }
+    T at(const Vec3f& bc) const {
+        return a + b * bc[1] + c * bc[2];
+    }
+};
+
 class Shader {
+protected:
+    Matrix mvpMatrix;
+    bool hasMVP;
+    //Filter of every texture fetch, part of the draw state so concurrent draws may differ
+    TextureFilter filter;
+    //Built-in shaders draw through kernels specialized on their type, false forces the virtual calls
+    bool specialized;
+    //Texture fetches since the last takeTextureSamples(), kept per shader copy so counting needs no thread-local lookup
+    long long textureSamples;
+
+    TGAColor sampleTexture(const Texture& texture, Vec2f uv, float lod) {
+        textureSamples++;
+        return texture->sample(uv, lod, filter);
+    }
 public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Shader() : hasMVP(false), filter(FILTER_NEAREST), specialized(true), textureSamples(0) {}
     //㲢MVP任ĶĻϵ꣬ͬʱƬԪɫ
 	virtual Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) = 0;
+    //ֻƬԪɫݣȾ任Ĭֱӵvertex()
+    virtual void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        vertex(modelVertex, uv, normal, idx);
+    }
+    //ģͺ決˻ڱʱvarying()vertex()֮붥ڱֵ1Ϊȫڱ
+    virtual void occlusion(float ao, int idx) {}
     //ƬԪɫжǷҪȾ
 	virtual bool fragment(Vec3f bc, TGAColor& color) = 0;
+    //Ƶǰɫ߳Ⱦʱÿ߳ʹøԵĸ
+    virtual Shader* clone() = 0;
+    //vertex()varying()֮ÿεһΣԤͼԪƽ淽̹fragment()ʹ
+    virtual void setup(Vec3f* screenCoords) {}
+    virtual ~Shader() {}
+
+    //Set before drawing, copies made by clone() inherit it
+    void setFilter(TextureFilter filter) {
+        this->filter = filter;
+    }
+
+    void setSpecialized(bool enabled) {
+        specialized = enabled;
+    }
+    bool isSpecialized() const {
+        return specialized;
+    }
 
+    //Returns and resets the texture fetch count, the raster loops add it to the stats with their other counters
+    long long takeTextureSamples() {
+        long long n = textureSamples;
+        textureSamples = 0;
+        return n;
+    }
+
+    //ԤȺϳMVP󣬵úvertex()뷵mvp(modelVertex)Ⱦ任㲢֮乲
+    void setMVP(Matrix Viewport, Matrix Projection, Matrix View) {
+        mvpMatrix = Viewport * Projection * View;
+        hasMVP = true;
+    }
+    //nullptrʱȾÿvertex()
+    const Matrix* getMVP() {
+        return hasMVP ? &mvpMatrix : nullptr;
+    }
+    Vec3f mvp(Vec3f ModelVertex) {
+        Eigen::Matrix<float, 4, 1> matv;
+        matv(3, 0) = 1.0f;
+        for (int i = 0; i < 3; i++) matv(i, 0) = ModelVertex[i];
+        Eigen::Matrix<float, 4, 1> m = mvpMatrix * matv;
+        return Vec3f(m(0, 0) / m(3, 0), m(1, 0) / m(3, 0), m(2, 0) / m(3, 0));
+    }
 	Vec3f mvp(Matrix Viewport, Matrix Projection, Matrix View, Vec3f ModelVertex) {
 		Eigen::Matrix<float, 4, 1> matv;
 		matv(3, 0) = 1.0f;
@@ -21,16 +100,33 @@ public:
         Eigen::Matrix<float, 4, 1> m = Viewport * Projection * View * matv;
 		return Vec3f(m(0, 0) / m(3, 0), m(1, 0) / m(3, 0), m(2, 0) / m(3, 0));
 	}
-    //TBN
-    Eigen::Matrix3f tbn(Vec3f* v, Vec2i* uv, Vec3f n) {
+    //εĻ֮ȹUVmip㼶log2(ÿ)
+    float textureLod(Vec3f* screenCoords, Vec2i* uv) {
+        float texels = std::abs((float)((uv[1].x() - uv[0].x()) * (uv[2].y() - uv[0].y()) - (uv[2].x() - uv[0].x()) * (uv[1].y() - uv[0].y())));
+        float pixels = std::abs((screenCoords[1].x() - screenCoords[0].x()) * (screenCoords[2].y() - screenCoords[0].y())
+            - (screenCoords[2].x() - screenCoords[0].x()) * (screenCoords[1].y() - screenCoords[0].y()));
+        if (texels <= 0.0f || pixels <= 0.0f) return 0.0f;
+        return 0.5f * std::log2(texels / pixels);
+    }
+    //εT͸Bֻйأsetup()мһ
+    void tangents(Vec3f* v, Vec2i* uv, Vec3f& T, Vec3f& B) {
         Vec3f AB = v[1] - v[0];
         Vec3f AC = v[2] - v[0];
 
         Vec3f uv1 = Vec3f(uv[1].x() - uv[0].x(), uv[1].y() - uv[0].y(), 0);
         Vec3f uv2 = Vec3f(uv[2].x() - uv[0].x(), uv[2].y() - uv[0].y(), 0);
 
-        Vec3f T = (AB * uv2[1] - AC * uv1[1]) / (uv1[0] * uv2[1] - uv2[0] * uv1[1]);
-        Vec3f B = (AC * uv1[0] - AB * uv2[0]) / (uv1[0] * uv2[1] - uv2[0] * uv1[1]);
+        T = (AB * uv2[1] - AC * uv1[1]) / (uv1[0] * uv2[1] - uv2[0] * uv1[1]);
+        B = (AC * uv1[0] - AB * uv2[0]) / (uv1[0] * uv2[1] - uv2[0] * uv1[1]);
+    }
+    //TBN
+    Eigen::Matrix3f tbn(Vec3f* v, Vec2i* uv, Vec3f n) {
+        Vec3f T, B;
+        tangents(v, uv, T, B);
+        return tbn(T, B, n);
+    }
+    //εTBͲֵõTBN
+    Eigen::Matrix3f tbn(Vec3f T, Vec3f B, Vec3f n) {
         Vec3f q, w;
         for (int i = 0; i < 3; i++) {
             q[i] = (T.dot(n)) * n[i];
@@ -53,120 +149,134 @@ public:
     }
 };
 
-class FlatShader :public Shader {
+class FlatShader final :public Shader {
 private:
-    Matrix viewport;
-    Matrix projection;
-    Matrix view;
     Vec3f v[3];
     Vec2i uv[3];
     Vec3f lightDir;
-    TGAImage texture;
+    Texture texture;
+    float lod;
+    AttributePlane<Vec2f> uvPlane;
+    float intensity;
 public:
-    FlatShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, TGAImage& texture) {
-        this->viewport = viewport;
-        this->projection = projection;
-        this->view = view;
+    FlatShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, Texture texture) {
+        setMVP(viewport, projection, view);
+        lod = 0.0f;
         this->lightDir = lightDir.normalized();
         this->texture = texture;
     }
 
-    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+    Shader* clone() {
+        return new FlatShader(*this);
+    }
+
+    void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
         this->uv[idx] = uv;
         this->v[idx] = modelVertex;
+    }
+
+    void setup(Vec3f* screenCoords) {
+        lod = textureLod(screenCoords, uv);
+        uvPlane.set(uv[0].cast<float>(), uv[1].cast<float>(), uv[2].cast<float>());
+        Vec3f normal = (v[1] - v[0]).cross(v[2] - v[0]);
+        normal.normalize();
+        intensity = -(lightDir.dot(normal));
+    }
+
+    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        varying(modelVertex, uv, normal, idx);
 
         Vec3f gl_Pos;
-        gl_Pos = mvp(viewport, projection, view, modelVertex);
+        gl_Pos = mvp(modelVertex);
         return gl_Pos;
     }
     bool fragment(Vec3f bc, TGAColor& color) {
-        Vec3f normal = (v[1] - v[0]).cross(v[2] - v[0]);
-        normal.normalize();
-        Vec2i uvP(0, 0);
-        float intensityP = -(lightDir.dot(normal));
-        for (int i = 0; i < 3; i++) {
-            uvP.x() += uv[i].x() * bc[i];
-            uvP.y() += uv[i].y() * bc[i];
-        }
-        for (int i = 0; i < 3; i++) color[i] = std::min(255.0f, texture.get(uvP.x(), uvP.y())[i] * intensityP);
-        return false ? intensityP > 0:intensityP <= 0;
+        TGAColor c = sampleTexture(texture, uvPlane.at(bc), lod);
+        for (int i = 0; i < 3; i++) color[i] = std::min(255.0f, c[i] * intensity);
+        return false ? intensity > 0:intensity <= 0;
     }
 };
 
-class GouraudShader :public Shader {
+class GouraudShader final :public Shader {
 private:
-    Matrix viewport;
-    Matrix projection;
-    Matrix view;
     Vec3f normal[3];
     Vec2i uv[3];
     Vec3f lightDir;
-    TGAImage texture;
+    Texture texture;
+    float lod;
+    AttributePlane<Vec2f> uvPlane;
+    AttributePlane<float> intensityPlane;
 public:
-    GouraudShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, TGAImage& texture) {
-        this->viewport = viewport;
-        this->projection = projection;
-        this->view = view;
+    GouraudShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, Texture texture) {
+        setMVP(viewport, projection, view);
+        lod = 0.0f;
         this->lightDir = lightDir.normalized();
         this->texture = texture;
     }
 
-    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+    Shader* clone() {
+        return new GouraudShader(*this);
+    }
+
+    void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
         this->uv[idx] = uv;
         this->normal[idx] = normal;
+    }
+
+    void setup(Vec3f* screenCoords) {
+        lod = textureLod(screenCoords, uv);
+        uvPlane.set(uv[0].cast<float>(), uv[1].cast<float>(), uv[2].cast<float>());
+        intensityPlane.set(-(lightDir.dot(normal[0])), -(lightDir.dot(normal[1])), -(lightDir.dot(normal[2])));
+    }
+
+    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        varying(modelVertex, uv, normal, idx);
 
         Vec3f gl_Pos;
-        gl_Pos = mvp(viewport, projection, view, modelVertex);
+        gl_Pos = mvp(modelVertex);
         return gl_Pos;
     }
     bool fragment(Vec3f bc, TGAColor& color) {
-        float intensity[3];
-        for (int i = 0; i < 3; i++) {
-            intensity[i] = -(lightDir.dot(normal[i]));
-        }
-        Vec2i uvP(0, 0);
-        float intensityP = 0.0f;
-        for (int i = 0; i < 3; i++) {
-            uvP.x() += uv[i].x() * bc[i];
-            uvP.y() += uv[i].y() * bc[i];
-            intensityP += intensity[i] * bc[i];
-        }
-        for (int i = 0; i < 3; i++) color[i] = std::min(255.0f, texture.get(uvP.x(), uvP.y())[i] * intensityP);
+        float intensityP = intensityPlane.at(bc);
+        TGAColor c = sampleTexture(texture, uvPlane.at(bc), lod);
+        for (int i = 0; i < 3; i++) color[i] = std::min(255.0f, c[i] * intensityP);
         return false ? intensityP > 0:intensityP <= 0;
     }
 };
 
-class ToonShader :public Shader {
+class ToonShader final :public Shader {
 private:
-    Matrix viewport;
-    Matrix projection;
-    Matrix view;
     Vec3f normal[3];
     Vec2i uv[3];
     Vec3f lightDir;
+    AttributePlane<float> intensityPlane;
 public:
     ToonShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir) {
-        this->viewport = viewport;
-        this->projection = projection;
-        this->view = view;
+        setMVP(viewport, projection, view);
         this->lightDir = lightDir.normalized();
     }
 
-    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+    Shader* clone() {
+        return new ToonShader(*this);
+    }
+
+    void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
         this->uv[idx] = uv;
         this->normal[idx] = normal;
+    }
+
+    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        varying(modelVertex, uv, normal, idx);
 
         Vec3f gl_Pos;
-        gl_Pos = mvp(viewport, projection, view, modelVertex);
+        gl_Pos = mvp(modelVertex);
         return gl_Pos;
     }
+    void setup(Vec3f* screenCoords) {
+        intensityPlane.set(-(normal[0].dot(lightDir)), -(normal[1].dot(lightDir)), -(normal[2].dot(lightDir)));
+    }
     bool fragment(Vec3f bc, TGAColor& color) {
-        float intensity[3];
-        float intensityP = 0;
-        for (int i = 0; i < 3; i++) {
-            intensity[i] = -(normal[i].dot(lightDir));
-            intensityP += intensity[i] * bc[i];
-        }
+        float intensityP = intensityPlane.at(bc);
         if (intensityP > .85) intensityP = 1;
         else if (intensityP > .60) intensityP = .80;
         else if (intensityP > .45) intensityP = .60;
@@ -177,27 +287,32 @@ public:
     }
 };
 
-class PhongShader :public Shader {
+class PhongShader final :public Shader {
 private:
-    Matrix viewport;
-    Matrix projection;
-    Matrix view;
     Vec3f normal[3];
     Vec2i uv[3];
     Vec3f lightDir;
-    TGAImage texture;
+    Texture texture;
+    float lod;
 
     float ambient;
     Vec3f viewDir;
-    TGAImage specularMap;
+    Texture specularMap;
     float shininess;
-    TGAImage normalMap;
+    Texture normalMap;
     Vec3f v[3];
+    AttributePlane<Vec2f> uvPlane;
+    AttributePlane<Vec3f> normalPlane;
+    Vec3f tangent;
+    Vec3f bitangent;
+    const ShadowMap* shadowMap;
+    AttributePlane<Vec3f> shadowPlane;
+    float ao[3];
+    AttributePlane<float> aoPlane;
 public:
-    PhongShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, TGAImage& texture, float ambient, Vec3f viewDir, TGAImage& specularMap, float shininess, TGAImage& normalMap) {
-        this->viewport = viewport;
-        this->projection = projection;
-        this->view = view;
+    PhongShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, Texture texture, float ambient, Vec3f viewDir, Texture specularMap, float shininess, Texture normalMap) {
+        setMVP(viewport, projection, view);
+        lod = 0.0f;
         this->lightDir = lightDir.normalized();
         this->texture = texture;
         this->ambient = ambient;
@@ -205,33 +320,54 @@ public:
         this->specularMap = specularMap;
         this->shininess = shininess;
         this->normalMap = normalMap;
+        shadowMap = nullptr;
+        for (int i = 0; i < 3; i++) ao[i] = 1.0f;
     }
 
-    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+    //ΪnullptrʱӰӰͼɵ߳
+    void setShadowMap(const ShadowMap* shadowMap) {
+        this->shadowMap = shadowMap;
+    }
+
+    Shader* clone() {
+        return new PhongShader(*this);
+    }
+
+    void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
         this->uv[idx] = uv;
         this->normal[idx] = normal;
         this->v[idx] = modelVertex;
+    }
+
+    void occlusion(float ao, int idx) {
+        this->ao[idx] = ao;
+    }
+
+    void setup(Vec3f* screenCoords) {
+        lod = textureLod(screenCoords, uv);
+        uvPlane.set(uv[0].cast<float>(), uv[1].cast<float>(), uv[2].cast<float>());
+        normalPlane.set(normal[0], normal[1], normal[2]);
+        tangents(v, uv, tangent, bitangent);
+        //ԴռΪͶӰ任ԲֵΪ׼ȷӰͼ
+        if (shadowMap) shadowPlane.set(shadowMap->transform(v[0]), shadowMap->transform(v[1]), shadowMap->transform(v[2]));
+        aoPlane.set(ao[0], ao[1], ao[2]);
+    }
+
+    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        varying(modelVertex, uv, normal, idx);
 
         Vec3f gl_Pos;
-        gl_Pos = mvp(viewport, projection, view, modelVertex);
+        gl_Pos = mvp(modelVertex);
         return gl_Pos;
     }
     bool fragment(Vec3f bc, TGAColor& color) {
         Vec3f normalP;
-        Vec2i uvP(0, 0);
-        Vec3f n(0, 0, 0);
-        for (int i = 0; i < 3; i++) {
-            uvP.x() += uv[i].x() * bc[i];
-            uvP.y() += uv[i].y() * bc[i];
-
-            //ֵõǰط
-            n.x() += normal[i].x() * bc[i];
-            n.y() += normal[i].y() * bc[i];
-            n.z() += normal[i].z() * bc[i];
-        }
-        Eigen::Matrix3f TBN = tbn(v, uv, n);
+        Vec2f uvP = uvPlane.at(bc);
+        //ֵõǰط
+        Vec3f n = normalPlane.at(bc);
+        Eigen::Matrix3f TBN = tbn(tangent, bitangent, n);
         //ͼrgbֱ𱣴淨xyz
-        TGAColor c = normalMap.get(uvP[0], uvP[1]);
+        TGAColor c = sampleTexture(normalMap, uvP, lod);
         for (int i = 0; i < 3; i++)
             normalP[2 - i] = (float)c[i] / 255.f * 2.f - 1.f;
         normalP.normalize();
@@ -245,33 +381,48 @@ public:
         Vec3f reflectDir = normalP * (normalP.dot(lightDir) * 2) - lightDir;
         reflectDir.normalize();
         float specular = 0.6 * pow(std::max(0.0f, reflectDir.dot(viewDir)), shininess);
+        TGAColor diffuseColor = sampleTexture(texture, uvP, lod);
+        TGAColor specularColor = sampleTexture(specularMap, uvP, lod);
+        //ڱֻڻ
+        float occlusionP = aoPlane.at(bc);
+        //Ӱֻ
+        if (shadowMap) {
+            float lit = shadowMap->lit(shadowPlane.at(bc));
+            diffuse *= lit;
+            specular *= lit;
+        }
         for (int i = 0; i < 3; i++)
-            color[i] = std::min(255.0f, texture.get(uvP.x(), uvP.y())[i] * (ambient + diffuse) + specularMap.get(uvP.x(), uvP.y())[i] * specular);
+            color[i] = std::min(255.0f, diffuseColor[i] * (ambient * occlusionP + diffuse) + specularColor[i] * specular);
         return false;
     }
 };
 
-class BlinnPhongShader :public Shader {
+class BlinnPhongShader final :public Shader {
 private:
-    Matrix viewport;
-    Matrix projection;
-    Matrix view;
     Vec3f normal[3];
     Vec2i uv[3];
     Vec3f lightDir;
-    TGAImage texture;
+    Texture texture;
+    float lod;
 
     float ambient;
     Vec3f viewDir;
-    TGAImage specularMap;
+    Texture specularMap;
     float shininess;
-    TGAImage normalMap;
+    Texture normalMap;
     Vec3f v[3];
+    AttributePlane<Vec2f> uvPlane;
+    AttributePlane<Vec3f> normalPlane;
+    Vec3f tangent;
+    Vec3f bitangent;
+    const ShadowMap* shadowMap;
+    AttributePlane<Vec3f> shadowPlane;
+    float ao[3];
+    AttributePlane<float> aoPlane;
 public:
-    BlinnPhongShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, TGAImage& texture, float ambient, Vec3f viewDir, TGAImage& specularMap, float shininess, TGAImage& normalMap) {
-        this->viewport = viewport;
-        this->projection = projection;
-        this->view = view;
+    BlinnPhongShader(Matrix viewport, Matrix projection, Matrix view, Vec3f lightDir, Texture texture, float ambient, Vec3f viewDir, Texture specularMap, float shininess, Texture normalMap) {
+        setMVP(viewport, projection, view);
+        lod = 0.0f;
         this->lightDir = lightDir.normalized();
         this->texture = texture;
         this->ambient = ambient;
@@ -279,35 +430,56 @@ public:
         this->specularMap = specularMap;
         this->shininess = shininess;
         this->normalMap = normalMap;
+        shadowMap = nullptr;
+        for (int i = 0; i < 3; i++) ao[i] = 1.0f;
     }
 
-    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+    //ΪnullptrʱӰӰͼɵ߳
+    void setShadowMap(const ShadowMap* shadowMap) {
+        this->shadowMap = shadowMap;
+    }
+
+    Shader* clone() {
+        return new BlinnPhongShader(*this);
+    }
+
+    void varying(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
         this->uv[idx] = uv;
         this->normal[idx] = normal;
         this->v[idx] = modelVertex;
+    }
+
+    void occlusion(float ao, int idx) {
+        this->ao[idx] = ao;
+    }
+
+    void setup(Vec3f* screenCoords) {
+        lod = textureLod(screenCoords, uv);
+        uvPlane.set(uv[0].cast<float>(), uv[1].cast<float>(), uv[2].cast<float>());
+        normalPlane.set(normal[0], normal[1], normal[2]);
+        tangents(v, uv, tangent, bitangent);
+        //ԴռΪͶӰ任ԲֵΪ׼ȷӰͼ
+        if (shadowMap) shadowPlane.set(shadowMap->transform(v[0]), shadowMap->transform(v[1]), shadowMap->transform(v[2]));
+        aoPlane.set(ao[0], ao[1], ao[2]);
+    }
+
+    Vec3f vertex(Vec3f modelVertex, Vec2i uv, Vec3f normal, int idx) {
+        varying(modelVertex, uv, normal, idx);
 
         Vec3f gl_Pos;
-        gl_Pos = mvp(viewport, projection, view, modelVertex);
+        gl_Pos = mvp(modelVertex);
         return gl_Pos;
     }
     bool fragment(Vec3f bc, TGAColor& color) {
         Vec3f normalP;
-        Vec2i uvP(0, 0);
-        Vec3f n(0, 0, 0);
-        for (int i = 0; i < 3; i++) {
-            uvP.x() += uv[i].x() * bc[i];
-            uvP.y() += uv[i].y() * bc[i];
+        Vec2f uvP = uvPlane.at(bc);
+        //ֵõǰط
+        Vec3f n = normalPlane.at(bc);
 
-            //ֵõǰط
-            n.x() += normal[i].x() * bc[i];
-            n.y() += normal[i].y() * bc[i];
-            n.z() += normal[i].z() * bc[i];
-        }
-        
-        Eigen::Matrix3f TBN = tbn(v, uv, n);
+        Eigen::Matrix3f TBN = tbn(tangent, bitangent, n);
         
         //ͼrgbֱ𱣴淨xyz
-        TGAColor c = normalMap.get(uvP[0], uvP[1]);
+        TGAColor c = sampleTexture(normalMap, uvP, lod);
         for (int i = 0; i < 3; i++)
             n[2 - i] = (float)c[i] / 255.f * 2.f - 1.f;
         n.normalize();
@@ -321,8 +493,18 @@ public:
         //viewlightнһķPhongģͷ߼нǴ90ȵ¸߹ⲻ
         Vec3f half = (lightDir + viewDir).normalized();
         float specular = 0.5 * pow(std::max(0.0f, -(half.dot(normalP))), shininess);
+        TGAColor diffuseColor = sampleTexture(texture, uvP, lod);
+        TGAColor specularColor = sampleTexture(specularMap, uvP, lod);
+        //ڱֻڻ
+        float occlusionP = aoPlane.at(bc);
+        //Ӱֻ
+        if (shadowMap) {
+            float lit = shadowMap->lit(shadowPlane.at(bc));
+            diffuse *= lit;
+            specular *= lit;
+        }
         for (int i = 0; i < 4; i++)
-            color[i] = std::min(255.0f, texture.get(uvP.x(), uvP.y())[i] * (ambient + diffuse) + specularMap.get(uvP.x(), uvP.y())[i] * specular);
+            color[i] = std::min(255.0f, diffuseColor[i] * (ambient * occlusionP + diffuse) + specularColor[i] * specular);
         return false;
     }
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include "gl.h"
+#include "shadowmap.h"
+
+ShadowMap::ShadowMap(int size, Vec3f lightDir, Vec3f center, float radius) : depth(size, size), size(size), pcf(false),
+    bias(0.02f) {
+    Vec3f dir = lightDir.normalized();
+    Vec3f eye = center - dir * radius;
+    //A vertical light is parallel to the usual up axis, look along it with z up instead
+    Vec3f up = std::abs(dir.y()) > 0.999f ? Vec3f(0, 0, 1.0f) : Vec3f(0, 1.0f, 0);
+    Matrix projection = Matrix::Identity();
+    for (int i = 0; i < 3; i++) projection(i, i) = 1.0f / radius;
+    mvp = getViewport(size, size) * projection * getView(eye, center, up);
+    data = depth.buffer();
+}
+
+void ShadowMap::setPCF(bool enabled) {
+    pcf = enabled;
+}
+
+void ShadowMap::setBias(float bias) {
+    this->bias = bias;
+}
+
+void ShadowMap::clear() {
+    depth.clear();
+}
+
+void ShadowMap::render(Model* model, ThreadPool& pool) {
+    drawDepth(model, mvp, depth, pool);
+}
+
+Vec3f ShadowMap::transform(Vec3f modelVertex) const {
+    Eigen::Matrix<float, 4, 1> m = mvp * Eigen::Matrix<float, 4, 1>(modelVertex.x(), modelVertex.y(), modelVertex.z(), 1.0f);
+    return Vec3f(m(0, 0), m(1, 0), m(2, 0));
+}
+
+float ShadowMap::lit(Vec3f lightPos) const {
+    int x = (int)lightPos.x(), y = (int)lightPos.y();
+    float z = lightPos.z() + bias;
+    if (x < 0 || y < 0 || x >= size || y >= size) return 1.0f;
+    if (!pcf) {
+        return data[x + y * size] > z ? 0.0f : 1.0f;
+    }
+    int litSamples = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            int sx = std::min(std::max(x + dx, 0), size - 1), sy = std::min(std::max(y + dy, 0), size - 1);
+            if (data[sx + sy * size] <= z) litSamples++;
+        }
+    }
+    return litSamples / 9.0f;
+}
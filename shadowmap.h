@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include "zbuffer.h"
+
+typedef Eigen::Matrix4f Matrix;
+typedef Eigen::Vector3f Vec3f;
+
+class Model;
+class ThreadPool;
+
+//Depth of the scene seen from a directional light through an orthographic projection, larger depth is
+//closer to the light like the main zbuffer
+class ShadowMap {
+private:
+    Matrix mvp;
+    ZBuffer depth;
+    const float* data;
+    int size;
+    bool pcf;
+    float bias;
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    //Covers the sphere of the given radius around center, lightDir is the direction the light travels
+    ShadowMap(int size, Vec3f lightDir, Vec3f center, float radius);
+    ShadowMap(const ShadowMap&) = delete;
+    ShadowMap& operator =(const ShadowMap&) = delete;
+    //3x3 percentage closer filtering instead of a single depth comparison
+    void setPCF(bool enabled);
+    void setBias(float bias);
+    void clear();
+    //Adds the model's depth to the map through the depth-only raster path
+    void render(Model* model, ThreadPool& pool);
+    //Model space position to shadow map pixel coordinates and light depth
+    Vec3f transform(Vec3f modelVertex) const;
+    //Fraction of the light reaching a point already in shadow map coordinates, 0 is fully shadowed
+    float lit(Vec3f lightPos) const;
+};
@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "tgaimage.h"
+
+//Built on its own: tests/tga_roundtrip.cpp tgaimage.cpp, run from any writable directory
+//Writes RLE and raw images of every pixel format and reads them back, exits non-zero on a mismatch
+
+//Fills the image with one of several pixel patterns that stress different packet mixes
+static void fill(TGAImage& image, int pattern, std::mt19937& rng) {
+    int bpp = image.get_bytespp();
+    unsigned char* data = image.buffer();
+    int n = image.get_width() * image.get_height();
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < bpp; c++) {
+            unsigned char v;
+            if (pattern == 0) v = (unsigned char)rng();
+            //Short runs of random length, mostly 1 to 3 pixels
+            else if (pattern == 1) v = (unsigned char)((i - i % (1 + (i / 7) % 3)) * 31 + c);
+            //One literal pixel then a run of two: "a bb c dd ...", the worst case for the packet headers
+            else if (pattern == 2) v = (unsigned char)((i / 3) * 2 + (i % 3 != 0) + c);
+            //Long runs crossing the 128 pixel packet limit
+            else v = (unsigned char)(i / 300 + c);
+            data[i * bpp + c] = v;
+        }
+    }
+}
+
+int main() {
+    const int formats[3] = { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA };
+    const int sizes[][2] = { { 1, 1 }, { 127, 3 }, { 128, 2 }, { 129, 5 }, { 1024, 4 }, { 257, 300 } };
+    std::mt19937 rng(1);
+    int failures = 0;
+    for (int bpp : formats) {
+        for (const int* size : sizes) {
+            for (int pattern = 0; pattern < 4; pattern++) {
+                for (int rle = 0; rle < 2; rle++) {
+                    TGAImage image(size[0], size[1], bpp);
+                    fill(image, pattern, rng);
+                    TGAImage loaded;
+                    bool ok = image.write_tga_file("tga_roundtrip.tga", rle != 0)
+                        && loaded.read_tga_file("tga_roundtrip.tga")
+                        && loaded.get_width() == size[0] && loaded.get_height() == size[1]
+                        && loaded.get_bytespp() == bpp
+                        && !memcmp(loaded.buffer(), image.buffer(), (size_t)size[0] * size[1] * bpp);
+                    if (!ok) {
+                        printf("FAIL bpp %d size %dx%d pattern %d rle %d\n", bpp, size[0], size[1], pattern, rle);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    std::remove("tga_roundtrip.tga");
+    printf("%s\n", failures ? "tga round trip failed" : "tga round trip ok");
+    return failures ? 1 : 0;
+}
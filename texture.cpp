@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string.h>
+#include "texture.h"
+
+static const int TEXTURE_TILE = 8;
+
+//Spreads the 3 low bits of v to the even bits, x and y interleave into the Morton index inside a tile
+static inline int spreadBits(int v) {
+    return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2);
+}
+
+MipTexture::MipTexture(const TGAImage& img) : bytespp(img.get_bytespp()) {
+    int w = img.get_width(), h = img.get_height();
+    if (w <= 0 || h <= 0) return;
+    while (true) {
+        Level level;
+        level.width = w;
+        level.height = h;
+        level.tilesX = (w + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        int tilesY = (h + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        level.texels.assign(level.tilesX * tilesY * TEXTURE_TILE * TEXTURE_TILE, 0);
+        levels.push_back(level);
+        if (w == 1 && h == 1) break;
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    for (int i = 0; i < (int)levels.size(); i++) {
+        Level& level = levels[i];
+        for (int y = 0; y < level.height; y++) {
+            for (int x = 0; x < level.width; x++) {
+                unsigned char bgra[4] = { 0, 0, 0, 0 };
+                if (i == 0) {
+                    TGAColor c = img.get(x, y);
+                    memcpy(bgra, c.bgra, 4);
+                }
+                else {
+                    //2x2 box filter of the previous level, edge texels repeat on odd sizes
+                    const Level& prev = levels[i - 1];
+                    int sum[4] = { 0, 0, 0, 0 };
+                    for (int k = 0; k < 4; k++) {
+                        unsigned int t = fetch(prev, x * 2 + (k & 1), y * 2 + (k >> 1));
+                        for (int c = 0; c < 4; c++) sum[c] += (t >> (c * 8)) & 0xff;
+                    }
+                    for (int c = 0; c < 4; c++) bgra[c] = (unsigned char)((sum[c] + 2) / 4);
+                }
+                int tile = x / TEXTURE_TILE + y / TEXTURE_TILE * level.tilesX;
+                int idx = tile * TEXTURE_TILE * TEXTURE_TILE + spreadBits(x % TEXTURE_TILE) + (spreadBits(y % TEXTURE_TILE) << 1);
+                memcpy(&level.texels[idx], bgra, 4);
+            }
+        }
+    }
+}
+
+int MipTexture::getWidth() const {
+    return levels.empty() ? 0 : levels[0].width;
+}
+
+int MipTexture::getHeight() const {
+    return levels.empty() ? 0 : levels[0].height;
+}
+
+int MipTexture::getLevels() const {
+    return (int)levels.size();
+}
+
+unsigned int MipTexture::fetch(const Level& level, int x, int y) const {
+    x = std::min(std::max(x, 0), level.width - 1);
+    y = std::min(std::max(y, 0), level.height - 1);
+    int tile = x / TEXTURE_TILE + y / TEXTURE_TILE * level.tilesX;
+    return level.texels[tile * TEXTURE_TILE * TEXTURE_TILE + spreadBits(x % TEXTURE_TILE) + (spreadBits(y % TEXTURE_TILE) << 1)];
+}
+
+void MipTexture::bilinear(int level, float x, float y, float* out) const {
+    const Level& l = levels[level];
+    float scale = 1.0f / (1 << level);
+    float fx = x * scale - 0.5f, fy = y * scale - 0.5f;
+    int x0 = (int)std::floor(fx), y0 = (int)std::floor(fy);
+    float tx = fx - x0, ty = fy - y0;
+    unsigned int t[4] = { fetch(l, x0, y0), fetch(l, x0 + 1, y0), fetch(l, x0, y0 + 1), fetch(l, x0 + 1, y0 + 1) };
+    for (int c = 0; c < 4; c++) {
+        float a = (float)((t[0] >> (c * 8)) & 0xff) * (1 - tx) + (float)((t[1] >> (c * 8)) & 0xff) * tx;
+        float b = (float)((t[2] >> (c * 8)) & 0xff) * (1 - tx) + (float)((t[3] >> (c * 8)) & 0xff) * tx;
+        out[c] = a * (1 - ty) + b * ty;
+    }
+}
+
+bool parseTextureFilter(const std::string& name, TextureFilter& filter) {
+    if (name == "nearest") filter = FILTER_NEAREST;
+    else if (name == "bilinear") filter = FILTER_BILINEAR;
+    else if (name == "trilinear") filter = FILTER_TRILINEAR;
+    else return false;
+    return true;
+}
+
+TGAColor MipTexture::sample(Vec2f uv, float lod, TextureFilter filter) const {
+    TGAColor color;
+    if (levels.empty()) return color;
+    if (filter == FILTER_NEAREST) {
+        int x = (int)uv.x(), y = (int)uv.y();
+        if (x < 0 || y < 0 || x >= levels[0].width || y >= levels[0].height) return color;
+        unsigned int t = fetch(levels[0], x, y);
+        memcpy(color.bgra, &t, 4);
+        color.bytespp = bytespp;
+        return color;
+    }
+    float out[4];
+    if (filter == FILTER_BILINEAR || lod <= 0.0f || levels.size() == 1) {
+        bilinear(0, uv.x(), uv.y(), out);
+    }
+    else {
+        lod = std::min(lod, (float)(levels.size() - 1));
+        int l0 = (int)lod;
+        int l1 = std::min(l0 + 1, (int)levels.size() - 1);
+        float t = lod - l0;
+        float a[4], b[4];
+        bilinear(l0, uv.x(), uv.y(), a);
+        bilinear(l1, uv.x(), uv.y(), b);
+        for (int c = 0; c < 4; c++) out[c] = a[c] * (1 - t) + b[c] * t;
+    }
+    for (int c = 0; c < 4; c++) color.bgra[c] = (unsigned char)(out[c] + 0.5f);
+    color.bytespp = bytespp;
+    return color;
+}
+
+std::mutex TextureCache::mutex;
+std::condition_variable TextureCache::loaded;
+std::map<std::string, TextureCache::Entry> TextureCache::textures;
+
+Texture TextureCache::load(const std::string& filename) {
+    std::unique_lock<std::mutex> lock(mutex);
+    //Textures nobody holds anymore are dropped, a long running server would otherwise keep every path
+    for (auto it = textures.begin(); it != textures.end();) {
+        if (!it->second.loading && it->second.texture.expired()) it = textures.erase(it);
+        else ++it;
+    }
+    while (true) {
+        auto it = textures.find(filename);
+        if (it == textures.end()) break;
+        if (Texture texture = it->second.texture.lock()) return texture;
+        if (!it->second.loading) break;
+        loaded.wait(lock);
+    }
+    textures[filename].loading = true;
+    lock.unlock();
+    TGAImage img;
+    //Textures index v from the bottom, so rows are decoded bottom row first
+    bool ok = img.read_tga_file(filename.c_str(), TGAImage::BOTTOM_UP);
+    std::cerr << "texture file " << filename << " loading " << (ok ? "ok" : "failed") << std::endl;
+    Texture texture = std::make_shared<MipTexture>(ok ? img : TGAImage());
+    lock.lock();
+    Entry& entry = textures[filename];
+    entry.texture = texture;
+    entry.loading = false;
+    loaded.notify_all();
+    return texture;
+}
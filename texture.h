@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include "tgaimage.h"
+
+typedef Eigen::Vector2f Vec2f;
+
+enum TextureFilter {
+    FILTER_NEAREST, FILTER_BILINEAR, FILTER_TRILINEAR
+};
+
+//nearest, bilinear or trilinear, returns false for anything else
+bool parseTextureFilter(const std::string& name, TextureFilter& filter);
+
+//Sampler side copy of a TGAImage: packed 32 bit texels in 8x8 tiles with Morton order inside each
+//tile, so the texels around a sample share cache lines, plus a box filtered mip chain
+class MipTexture {
+private:
+    struct Level {
+        int width;
+        int height;
+        int tilesX;
+        std::vector<unsigned int> texels;
+    };
+    std::vector<Level> levels;
+    int bytespp;
+
+    unsigned int fetch(const Level& level, int x, int y) const;
+    void bilinear(int level, float x, float y, float* out) const;
+public:
+    MipTexture(const TGAImage& img);
+    int getWidth() const;
+    int getHeight() const;
+    int getLevels() const;
+    //uv in level 0 texels, lod = log2 of texels per pixel; nearest reads level 0 like TGAImage::get()
+    TGAColor sample(Vec2f uv, float lod, TextureFilter filter) const;
+};
+
+//Read-only texture shared by every model and shader that uses it
+typedef std::shared_ptr<const MipTexture> Texture;
+
+//Process wide cache keyed by path, a file is decoded once while anything still holds its Texture.
+//Decoding happens outside the lock, so different files load concurrently
+class TextureCache {
+private:
+    struct Entry {
+        std::weak_ptr<const MipTexture> texture;
+        //Set while one thread decodes the file, others asking for it wait on loaded
+        bool loading = false;
+    };
+    static std::mutex mutex;
+    static std::condition_variable loaded;
+    static std::map<std::string, Entry> textures;
+public:
+    //Loads the .tga flipped vertically like the models expect, a missing file gives an empty texture
+    static Texture load(const std::string& filename);
+};
@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <emmintrin.h>
 #include <iostream>
 #include <fstream>
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <thread>
 #include "tgaimage.h"
+#include "bits.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -37,111 +41,110 @@ TGAImage& TGAImage::operator =(const TGAImage& img) {
     return *this;
 }
 
-bool TGAImage::read_tga_file(const char* filename) {
+bool TGAImage::read_tga_file(const char* filename, RowOrder order) {
     if (data) delete[] data;
     data = NULL;
+    //The whole file is read with one call and decoded from memory
     std::ifstream in;
-    in.open(filename, std::ios::binary);
+    in.open(filename, std::ios::binary | std::ios::ate);
     if (!in.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
         in.close();
         return false;
     }
+    std::streamoff filesize = in.tellg();
+    std::vector<unsigned char> file(filesize > 0 ? (size_t)filesize : 0);
+    in.seekg(0);
+    in.read((char*)file.data(), file.size());
+    in.close();
     TGA_Header header;
-    in.read((char*)&header, sizeof(header));
-    if (!in.good()) {
-        in.close();
+    if (!in.good() || file.size() < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, file.data(), sizeof(header));
     width = header.width;
     height = header.height;
     bytespp = header.bitsperpixel >> 3;
     if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
-        in.close();
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
+    //Pixels follow the image id and the color map
+    size_t offset = sizeof(header) + (unsigned char)header.idlength;
+    if (header.colormaptype) offset += (size_t)(unsigned short)header.colormaplength * (((unsigned char)header.colormapdepth + 7) >> 3);
     unsigned long nbytes = bytespp * width * height;
     data = new unsigned char[nbytes];
+    //Rows land in the requested order while decoding instead of being flipped afterwards
+    bool bottomUp = !(header.imagedescriptor & 0x20);
+    bool flipped = bottomUp != (order == BOTTOM_UP);
     if (3 == header.datatypecode || 2 == header.datatypecode) {
-        in.read((char*)data, nbytes);
-        if (!in.good()) {
-            in.close();
+        if (offset > file.size() || file.size() - offset < nbytes) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        unsigned long linebytes = width * bytespp;
+        for (int y = 0; y < height; y++) {
+            memcpy(data + (flipped ? height - 1 - y : y) * linebytes, file.data() + offset + y * linebytes, linebytes);
+        }
     }
     else if (10 == header.datatypecode || 11 == header.datatypecode) {
-        if (!load_rle_data(in)) {
-            in.close();
+        if (offset > file.size() || !load_rle_data(file.data() + offset, file.size() - offset, flipped)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
     }
     else {
-        in.close();
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
-    if (!(header.imagedescriptor & 0x20)) {
-        flip_vertically();
-    }
     if (header.imagedescriptor & 0x10) {
         flip_horizontally();
     }
     std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
-    in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
+bool TGAImage::load_rle_data(const unsigned char* in, size_t size, bool flipped) {
     unsigned long pixelcount = width * height;
     unsigned long currentpixel = 0;
-    unsigned long currentbyte = 0;
-    TGAColor colorbuffer;
-    do {
-        unsigned char chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
+    size_t pos = 0;
+    while (currentpixel < pixelcount) {
+        if (pos >= size) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
-        if (chunkheader < 128) {
-            chunkheader++;
-            for (int i = 0; i < chunkheader; i++) {
-                in.read((char*)colorbuffer.bgra, bytespp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
+        unsigned char chunkheader = in[pos++];
+        bool run = chunkheader >= 128;
+        unsigned long count = run ? chunkheader - 127 : chunkheader + 1;
+        if (pos + (run ? 1 : count) * bytespp > size) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
         }
-        else {
-            chunkheader -= 127;
-            in.read((char*)colorbuffer.bgra, bytespp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
+        if (currentpixel + count > pixelcount) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        //Packets may cross scanlines, so copy or fill them one row piece at a time
+        while (count > 0) {
+            int y = currentpixel / width, x = currentpixel % width;
+            unsigned long n = std::min(count, (unsigned long)(width - x));
+            unsigned char* dst = data + ((flipped ? height - 1 - y : y) * width + x) * bytespp;
+            if (!run) {
+                memcpy(dst, in + pos, n * bytespp);
+                pos += n * bytespp;
+            }
+            else if (bytespp == 1) {
+                memset(dst, in[pos], n);
             }
-            for (int i = 0; i < chunkheader; i++) {
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            else {
+                for (unsigned long i = 0; i < n; i++) memcpy(dst + i * bytespp, in + pos, bytespp);
             }
+            currentpixel += n;
+            count -= n;
         }
-    } while (currentpixel < pixelcount);
+        if (run) pos += bytespp;
+    }
     return true;
 }
 
@@ -163,39 +166,25 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
     header.height = height;
     header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
     header.imagedescriptor = 0x20; // top-left origin
+    //Pixels are encoded in memory first and go out in a few large writes
     out.write((char*)&header, sizeof(header));
-    if (!out.good()) {
-        out.close();
-        std::cerr << "can't dump the tga file\n";
-        return false;
-    }
     if (!rle) {
         out.write((char*)data, width * height * bytespp);
-        if (!out.good()) {
-            std::cerr << "can't unload raw data\n";
-            out.close();
-            return false;
-        }
     }
     else {
-        if (!unload_rle_data(out)) {
-            out.close();
-            std::cerr << "can't unload rle data\n";
-            return false;
+        //Scanline ranges are independent, each thread encodes its own into a separate buffer
+        int threads = std::max(1, std::min((int)std::thread::hardware_concurrency(), height / 64));
+        std::vector<std::vector<unsigned char> > parts(threads);
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) {
+            workers.emplace_back([&, t]() { unload_rle_data(parts[t], height * t / threads, height * (t + 1) / threads); });
         }
+        unload_rle_data(parts[0], 0, height / threads);
+        for (std::thread& worker : workers) worker.join();
+        for (std::vector<unsigned char>& part : parts) out.write((char*)part.data(), part.size());
     }
     out.write((char*)developer_area_ref, sizeof(developer_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
     out.write((char*)extension_area_ref, sizeof(extension_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
     out.write((char*)footer, sizeof(footer));
     if (!out.good()) {
         std::cerr << "can't dump the tga file\n";
@@ -206,50 +195,98 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
     return true;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream& out) {
-    const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width * height;
-    unsigned long curpix = 0;
-    while (curpix < npixels) {
-        unsigned long chunkstart = curpix * bytespp;
-        unsigned long curbyte = curpix * bytespp;
-        unsigned char run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length) {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bytespp; t++) {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-            }
-            curbyte += bytespp;
-            if (1 == run_length) {
-                raw = !succ_eq;
-            }
-            if (raw && succ_eq) {
-                run_length--;
-                break;
-            }
-            if (!raw && !succ_eq) {
-                break;
-            }
-            run_length++;
+//Pixel as an integer so it compares in one instruction, Bpp is the byte count of a pixel
+template<int Bpp>
+static inline unsigned int load_pixel(const unsigned char* p) {
+    if (Bpp == 4) {
+        unsigned int v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    if (Bpp == 3) return p[0] | p[1] << 8 | p[2] << 16;
+    return p[0];
+}
+
+//Number of pixels among the first n that repeat p[0]
+template<int Bpp>
+static int repeat_length(const unsigned char* p, int n) {
+    unsigned int first = load_pixel<Bpp>(p);
+    int i = 1;
+    if (Bpp == 4) {
+        //Four pixels per compare against the broadcast first pixel
+        const __m128i ref = _mm_set1_epi32((int)first);
+        for (; i + 4 <= n; i += 4) {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p + i * 4)), ref));
+            if (mask != 0xffff) return i + countTrailingZeros(~mask) / 4;
         }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
+    }
+    while (i < n && load_pixel<Bpp>(p + i * Bpp) == first) i++;
+    return i;
+}
+
+//Number of leading pixels among the first n before two consecutive ones are equal
+template<int Bpp>
+static int literal_length(const unsigned char* p, int n) {
+    int i = 0;
+    if (Bpp == 4) {
+        //Each pixel against its right neighbour, four at a time
+        for (; i + 5 <= n; i += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(p + i * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + i * 4 + 4));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(a, b));
+            if (mask) return i + countTrailingZeros(mask) / 4;
         }
-        out.write((char*)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
+    }
+    unsigned int cur = load_pixel<Bpp>(p + i * Bpp);
+    for (; i + 1 < n; i++) {
+        unsigned int next = load_pixel<Bpp>(p + (i + 1) * Bpp);
+        if (next == cur) return i;
+        cur = next;
+    }
+    return n;
+}
+
+template<int Bpp>
+static unsigned char* encode_rle(const unsigned char* line, int width, unsigned char* dst) {
+    const int max_chunk_length = 128;
+    int x = 0;
+    while (x < width) {
+        int left = std::min(max_chunk_length, width - x);
+        const unsigned char* p = line + x * Bpp;
+        int run = repeat_length<Bpp>(p, left);
+        if (run > 1) {
+            *dst++ = (unsigned char)(run + 127);
+            memcpy(dst, p, Bpp);
+            dst += Bpp;
+            x += run;
+        }
+        else {
+            int raw = std::max(1, literal_length<Bpp>(p, left));
+            *dst++ = (unsigned char)(raw - 1);
+            memcpy(dst, p, raw * Bpp);
+            dst += raw * Bpp;
+            x += raw;
         }
     }
-    return true;
+    return dst;
+}
+
+void TGAImage::unload_rle_data(std::vector<unsigned char>& out, int y0, int y1) const {
+    //Every packet covers at least one pixel, so one header byte per pixel bounds the output;
+    //alternating literals and two pixel runs come close at 1 bpp. Sized once, trimmed at the end
+    size_t start = out.size();
+    out.resize(start + (size_t)(y1 - y0) * width * (bytespp + 1));
+    unsigned char* dst = out.data() + start;
+    for (int y = y0; y < y1; y++) {
+        const unsigned char* line = data + y * width * bytespp;
+        if (bytespp == RGBA) dst = encode_rle<4>(line, width, dst);
+        else if (bytespp == RGB) dst = encode_rle<3>(line, width, dst);
+        else dst = encode_rle<1>(line, width, dst);
+    }
+    out.resize(dst - out.data());
 }
 
-TGAColor TGAImage::get(int x, int y) {
+TGAColor TGAImage::get(int x, int y) const {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return TGAColor();
     }
@@ -272,15 +309,15 @@ bool TGAImage::set(int x, int y, const TGAColor& c) {
     return true;
 }
 
-int TGAImage::get_bytespp() {
+int TGAImage::get_bytespp() const {
     return bytespp;
 }
 
-int TGAImage::get_width() {
+int TGAImage::get_width() const {
     return width;
 }
 
-int TGAImage::get_height() {
+int TGAImage::get_height() const {
     return height;
 }
 
@@ -2,6 +2,7 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <vector>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -70,29 +71,35 @@ protected:
     int height;
     int bytespp;
 
-    bool   load_rle_data(std::ifstream& in);
-    bool unload_rle_data(std::ofstream& out);
+    //Decodes the RLE packets of a file already in memory, flipped stores the rows in reverse order
+    bool   load_rle_data(const unsigned char* in, size_t size, bool flipped);
+    //Appends the RLE packets of rows [y0, y1) to out, packets never cross a scanline
+    void unload_rle_data(std::vector<unsigned char>& out, int y0, int y1) const;
 public:
     enum Format {
         GRAYSCALE = 1, RGB = 3, RGBA = 4
     };
+    //Row order in memory after reading: top row first, or bottom row first as textures index it
+    enum RowOrder {
+        TOP_DOWN, BOTTOM_UP
+    };
 
     TGAImage();
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage& img);
-    bool read_tga_file(const char* filename);
+    bool read_tga_file(const char* filename, RowOrder order = TOP_DOWN);
     bool write_tga_file(const char* filename, bool rle = true);
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
-    TGAColor get(int x, int y);
+    TGAColor get(int x, int y) const;
     bool set(int x, int y, TGAColor& c);
     bool set(int x, int y, const TGAColor& c);
     ~TGAImage();
     TGAImage& operator =(const TGAImage& img);
-    int get_width();
-    int get_height();
-    int get_bytespp();
+    int get_width() const;
+    int get_height() const;
+    int get_bytespp() const;
     unsigned char* buffer();
     void clear();
 };
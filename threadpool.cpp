@@ -0,0 +1,65 @@
+#include <algorithm>
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int nthreads) : job(nullptr), next(0), count(0), pending(0), generation(0), stop(false) {
+    if (nthreads <= 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < nthreads; i++) {
+        workers.emplace_back(&ThreadPool::loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers) t.join();
+}
+
+int ThreadPool::size() {
+    return (int)workers.size() + 1;
+}
+
+void ThreadPool::work(int worker) {
+    for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+        (*job)(i, worker);
+    }
+}
+
+void ThreadPool::loop(int worker) {
+    unsigned seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) return;
+            seen = generation;
+        }
+        work(worker);
+        std::unique_lock<std::mutex> lock(mutex);
+        if (--pending == 0) done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)>& fn) {
+    if (count <= 0) return;
+    if (workers.empty() || count == 1) {
+        for (int i = 0; i < count; i++) fn(i, 0);
+        return;
+    }
+    std::unique_lock<std::mutex> guard(submit);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->job = &fn;
+        this->count = count;
+        this->next = 0;
+        this->pending = (int)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
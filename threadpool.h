@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex submit;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)>* job;
+    std::atomic<int> next;
+    int count;
+    int pending;
+    unsigned generation;
+    bool stop;
+
+    void loop(int worker);
+    void work(int worker);
+public:
+    //nthreads <= 0 uses every hardware thread; the calling thread counts as worker 0
+    ThreadPool(int nthreads = 0);
+    ~ThreadPool();
+    int size();
+    //Runs fn(index, worker) for every index in [0, count) and blocks until all are done
+    void parallelFor(int count, const std::function<void(int, int)>& fn);
+};
@@ -0,0 +1,47 @@
+#include <algorithm>
+#include "vertexcache.h"
+
+static const int VERTEX_BATCH = 4096;
+
+void VertexCache::transformBatch(Model* model, const Matrix& mvp, int begin, int end) {
+    Span<Vec3f> verts = model->verts();
+    for (int i = begin; i < end; i++) {
+        const Vec3f& v = verts[i];
+        Eigen::Matrix<float, 4, 1> m = mvp * Eigen::Matrix<float, 4, 1>(v.x(), v.y(), v.z(), 1.0f);
+        cx[i] = m(0, 0);
+        cy[i] = m(1, 0);
+        cz[i] = m(2, 0);
+        cw[i] = m(3, 0);
+        x[i] = m(0, 0) / m(3, 0);
+        y[i] = m(1, 0) / m(3, 0);
+        z[i] = m(2, 0) / m(3, 0);
+    }
+}
+
+void VertexCache::resize(int n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    cx.resize(n);
+    cy.resize(n);
+    cz.resize(n);
+    cw.resize(n);
+}
+
+void VertexCache::transform(Model* model, const Matrix& mvp) {
+    int n = model->nverts();
+    resize(n);
+    transformBatch(model, mvp, 0, n);
+}
+
+void VertexCache::transform(Model* model, const Matrix& mvp, ThreadPool& pool) {
+    int n = model->nverts();
+    resize(n);
+    pool.parallelFor((n + VERTEX_BATCH - 1) / VERTEX_BATCH, [&](int batch, int worker) {
+        transformBatch(model, mvp, batch * VERTEX_BATCH, std::min(n, (batch + 1) * VERTEX_BATCH));
+    });
+}
+
+int VertexCache::size() {
+    return (int)x.size();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Dense>
+#include "model.h"
+#include "threadpool.h"
+
+typedef Eigen::Matrix4f Matrix;
+typedef Eigen::Vector3f Vec3f;
+typedef Eigen::Vector4f Vec4f;
+
+//Screen positions of every vertex of a model for one draw, stored as separate x/y/z arrays, plus the
+//homogeneous positions before the divide for primitive assembly; faces look their corners up through
+//Model::vertIndex instead of transforming them again
+class VertexCache {
+private:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> cx;
+    std::vector<float> cy;
+    std::vector<float> cz;
+    std::vector<float> cw;
+
+    void resize(int n);
+
+    void transformBatch(Model* model, const Matrix& mvp, int begin, int end);
+public:
+    void transform(Model* model, const Matrix& mvp);
+    void transform(Model* model, const Matrix& mvp, ThreadPool& pool);
+    int size();
+    Vec3f get(int i) {
+        return Vec3f(x[i], y[i], z[i]);
+    }
+    Vec4f clip(int i) {
+        return Vec4f(cx[i], cy[i], cz[i], cw[i]);
+    }
+};
@@ -0,0 +1,45 @@
+#include "visibility.h"
+
+VisibilityBuffer::VisibilityBuffer(int w, int h) : width(w), height(h), fragments(0) {
+    data = new Sample[width * height];
+    clear();
+}
+
+VisibilityBuffer::~VisibilityBuffer() {
+    delete[] data;
+}
+
+int VisibilityBuffer::getWidth() {
+    return width;
+}
+
+int VisibilityBuffer::getHeight() {
+    return height;
+}
+
+VisibilityBuffer::Sample& VisibilityBuffer::get(int x, int y) {
+    return data[x + y * width];
+}
+
+void VisibilityBuffer::set(int x, int y, int draw, int face, const Vec3f& bc) {
+    Sample& sample = data[x + y * width];
+    sample.draw = draw;
+    sample.face = face;
+    sample.bc = bc;
+}
+
+long long VisibilityBuffer::getFragments() {
+    return fragments;
+}
+
+void VisibilityBuffer::addFragments(long long n) {
+    fragments += n;
+}
+
+void VisibilityBuffer::clear() {
+    for (int i = 0; i < width * height; i++) {
+        data[i].draw = -1;
+        data[i].face = -1;
+    }
+    fragments = 0;
+}
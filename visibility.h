@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+typedef Eigen::Vector3f Vec3f;
+
+//Per-pixel record of the visible surface for deferred shading
+class VisibilityBuffer {
+public:
+    struct Sample {
+        int draw;
+        int face;
+        Vec3f bc;
+    };
+private:
+    Sample* data;
+    int width;
+    int height;
+    long long fragments;
+public:
+    VisibilityBuffer(int w, int h);
+    VisibilityBuffer(const VisibilityBuffer&) = delete;
+    VisibilityBuffer& operator =(const VisibilityBuffer&) = delete;
+    ~VisibilityBuffer();
+    int getWidth();
+    int getHeight();
+    Sample& get(int x, int y);
+    void set(int x, int y, int draw, int face, const Vec3f& bc);
+    //Depth test passes of the raster pass, i.e. the fragments forward shading would have run
+    long long getFragments();
+    void addFragments(long long n);
+    void clear();
+};
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <emmintrin.h>
+#include <limits>
+#include "zbuffer.h"
+
+ZBuffer::ZBuffer(int w, int h) : width(w), height(h) {
+    blocksX = (width + ZBUFFER_BLOCK - 1) / ZBUFFER_BLOCK;
+    blocksY = (height + ZBUFFER_BLOCK - 1) / ZBUFFER_BLOCK;
+    data = new float[width * height];
+    blockMin = new float[blocksX * blocksY];
+    blockMax = new float[blocksX * blocksY];
+    clear();
+}
+
+ZBuffer::~ZBuffer() {
+    delete[] data;
+    delete[] blockMin;
+    delete[] blockMax;
+}
+
+int ZBuffer::getWidth() {
+    return width;
+}
+
+int ZBuffer::getHeight() {
+    return height;
+}
+
+float* ZBuffer::buffer() {
+    return data;
+}
+
+float ZBuffer::getBlockMin(int bx, int by) {
+    return blockMin[bx + by * blocksX];
+}
+
+float ZBuffer::getBlockMax(int bx, int by) {
+    return blockMax[bx + by * blocksX];
+}
+
+void ZBuffer::updateBlock(int bx, int by) {
+    int x0 = bx * ZBUFFER_BLOCK, x1 = std::min(width, x0 + ZBUFFER_BLOCK);
+    int y0 = by * ZBUFFER_BLOCK, y1 = std::min(height, y0 + ZBUFFER_BLOCK);
+    float zmin = std::numeric_limits<float>::max();
+    float zmax = -std::numeric_limits<float>::max();
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            zmin = std::min(zmin, data[x + y * width]);
+            zmax = std::max(zmax, data[x + y * width]);
+        }
+    }
+    blockMin[bx + by * blocksX] = zmin;
+    blockMax[bx + by * blocksX] = zmax;
+}
+
+void ZBuffer::clear() {
+    //Four depths per store, the tail is filled one by one
+    const __m128 farthest = _mm_set1_ps(-std::numeric_limits<float>::max());
+    int n = width * height, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm_storeu_ps(data + i, farthest);
+        _mm_storeu_ps(data + i + 4, farthest);
+        _mm_storeu_ps(data + i + 8, farthest);
+        _mm_storeu_ps(data + i + 12, farthest);
+    }
+    std::fill(data + i, data + n, -std::numeric_limits<float>::max());
+    std::fill(blockMin, blockMin + blocksX * blocksY, -std::numeric_limits<float>::max());
+    std::fill(blockMax, blockMax + blocksX * blocksY, -std::numeric_limits<float>::max());
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+//Side of the square pixel blocks that keep coarse depth bounds
+const int ZBUFFER_BLOCK = 8;
+
+//Full resolution depth buffer plus the min/max depth of every ZBUFFER_BLOCK block,
+//larger depth is closer to the camera like the rest of the renderer
+class ZBuffer {
+private:
+    float* data;
+    float* blockMin;
+    float* blockMax;
+    int width;
+    int height;
+    int blocksX;
+    int blocksY;
+public:
+    ZBuffer(int w, int h);
+    ZBuffer(const ZBuffer&) = delete;
+    ZBuffer& operator =(const ZBuffer&) = delete;
+    ~ZBuffer();
+    int getWidth();
+    int getHeight();
+    float* buffer();
+    //Farthest and nearest depth stored in the block, a fragment not nearer than getBlockMin may still pass
+    float getBlockMin(int bx, int by);
+    float getBlockMax(int bx, int by);
+    //Recomputes the bounds of a block after its pixels were written
+    void updateBlock(int bx, int by);
+    void clear();
+};